@@ -0,0 +1,407 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput benchmarks for the kernels that archive-jni hooks in with the linker's --wrap. This
+// executable is linked with the same --wrap flags, so calling a hooked function reaches our
+// implementation while calling its __real_ counterpart reaches the original one, and each kernel
+// is measured against the code it replaces on the same device. CRC32 isn't hooked, because
+// libarchive already calls the platform libz for it, so that is measured against the table code
+// in archive_crc32.h that libarchive would use instead. The outputs of both are compared before
+// timing, so this doubles as a quick correctness check on hardware that the emulator doesn't
+// cover. The tar reader calls the hooked string conversion itself, so tar header parsing is only
+// reported as headers per second.
+//
+// Configure with -DLIBARCHIVE_ANDROID_BENCHMARK=ON, then push archive-benchmark to the device and
+// run it, e.g. from /data/local/tmp.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <archive.h>
+#include <archive_blake2.h>
+#include <archive_entry.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/sha1.h>
+#include <zlib.h>
+
+// archive_crc32.h is private to libarchive, which only uses its static crc32() when built without
+// zlib.
+#define __LIBARCHIVE_BUILD
+#define crc32 archiveTableCrc32
+#include <archive_crc32.h>
+#undef crc32
+
+#include "cpu-features.h"
+
+#define BENCHMARK_DATA_SIZE (1024 * 1024)
+#define BENCHMARK_MIN_DURATION_NANOS 500000000LL
+// Room for the begin and end lines and the 4/3 expansion plus a newline per line.
+#define UU_OUTPUT_SIZE (BENCHMARK_DATA_SIZE * 2)
+#define TAR_ENTRY_COUNT (1024 * 1024)
+// The number of copies of an entry that are handed to the reader at once.
+#define TAR_ENTRIES_PER_READ 64
+
+int __real_archive_write_add_filter_b64encode(struct archive *archive);
+int __real_archive_write_add_filter_uuencode(struct archive *archive);
+int __real_blake2sp_update(blake2sp_state *S, const void *pin, size_t inlen);
+int __real_mbedtls_aes_crypt_ecb(mbedtls_aes_context *ctx, int mode, const unsigned char input[16],
+                                 unsigned char output[16]);
+int __real_mbedtls_sha1_update_ret(mbedtls_sha1_context *ctx, const unsigned char *input,
+                                   size_t ilen);
+int __real_mbedtls_sha1_finish_ret(mbedtls_sha1_context *ctx, unsigned char output[20]);
+
+typedef void (*BenchmarkFunction)(const uint8_t *data, size_t size, uint8_t *output);
+
+static int64_t getMonotonicTimeNanos(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static double measureThroughput(BenchmarkFunction function, const uint8_t *data,
+                                uint8_t *output) {
+    // Warm up the caches and let the CPU leave its idle frequency.
+    function(data, BENCHMARK_DATA_SIZE, output);
+    int64_t startTime = getMonotonicTimeNanos();
+    int64_t duration;
+    size_t iterationCount = 0;
+    do {
+        function(data, BENCHMARK_DATA_SIZE, output);
+        ++iterationCount;
+        duration = getMonotonicTimeNanos() - startTime;
+    } while (duration < BENCHMARK_MIN_DURATION_NANOS);
+    return (double) iterationCount * BENCHMARK_DATA_SIZE / (1024 * 1024) / (duration / 1e9);
+}
+
+// Returns false if the two functions disagree.
+static bool runBenchmark(const char *name, BenchmarkFunction baselineFunction,
+                         BenchmarkFunction optimizedFunction, const uint8_t *data,
+                         size_t outputSize) {
+    // Zeroed, so that any room left over compares equal.
+    uint8_t *baselineOutput = calloc(1, outputSize);
+    uint8_t *optimizedOutput = calloc(1, outputSize);
+    if (!baselineOutput || !optimizedOutput) {
+        fprintf(stderr, "%s: Out of memory\n", name);
+        free(baselineOutput);
+        free(optimizedOutput);
+        return false;
+    }
+    baselineFunction(data, BENCHMARK_DATA_SIZE, baselineOutput);
+    optimizedFunction(data, BENCHMARK_DATA_SIZE, optimizedOutput);
+    bool isOutputEqual = !memcmp(baselineOutput, optimizedOutput, outputSize);
+    if (isOutputEqual) {
+        double baselineThroughput = measureThroughput(baselineFunction, data, baselineOutput);
+        double optimizedThroughput = measureThroughput(optimizedFunction, data, optimizedOutput);
+        printf("%-12s %9.1f MiB/s %9.1f MiB/s %6.2fx\n", name, baselineThroughput,
+               optimizedThroughput, optimizedThroughput / baselineThroughput);
+    } else {
+        fprintf(stderr, "%s: Output mismatch\n", name);
+    }
+    free(baselineOutput);
+    free(optimizedOutput);
+    return isOutputEqual;
+}
+
+static const unsigned char BENCHMARK_KEY[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+
+typedef int (*AesCryptEcbFunction)(mbedtls_aes_context *ctx, int mode,
+                                   const unsigned char input[16], unsigned char output[16]);
+
+// WinZip AES as libarchive implements it, i.e. a little-endian counter starting at 1 and one ECB
+// call per block.
+static void aes256Ctr(AesCryptEcbFunction cryptEcb, const uint8_t *data, size_t size,
+                      uint8_t *output) {
+    mbedtls_aes_context ctx;
+    mbedtls_aes_init(&ctx);
+    mbedtls_aes_setkey_enc(&ctx, BENCHMARK_KEY, 256);
+    unsigned char counter[16] = { 1 };
+    unsigned char keyStream[16];
+    for (size_t offset = 0; offset < size; offset += sizeof(keyStream)) {
+        cryptEcb(&ctx, MBEDTLS_AES_ENCRYPT, counter, keyStream);
+        for (size_t i = 0; i < sizeof(counter) && !++counter[i]; ++i) {}
+        size_t blockSize = size - offset < sizeof(keyStream) ? size - offset : sizeof(keyStream);
+        for (size_t i = 0; i < blockSize; ++i) {
+            output[offset + i] = data[offset + i] ^ keyStream[i];
+        }
+    }
+    mbedtls_aes_free(&ctx);
+}
+
+static void aes256CtrOriginal(const uint8_t *data, size_t size, uint8_t *output) {
+    aes256Ctr(__real_mbedtls_aes_crypt_ecb, data, size, output);
+}
+
+static void aes256CtrHooked(const uint8_t *data, size_t size, uint8_t *output) {
+    aes256Ctr(mbedtls_aes_crypt_ecb, data, size, output);
+}
+
+typedef int (*Sha1UpdateFunction)(mbedtls_sha1_context *ctx, const unsigned char *input,
+                                  size_t ilen);
+typedef int (*Sha1FinishFunction)(mbedtls_sha1_context *ctx, unsigned char output[20]);
+
+// The HMAC construction from RFC 2104, spelled out so that both SHA-1 implementations can be
+// plugged in. libarchive reaches the same two functions through mbedtls_md_hmac_*().
+static void hmacSha1(Sha1UpdateFunction update, Sha1FinishFunction finish, const uint8_t *data,
+                     size_t size, uint8_t output[20]) {
+    unsigned char pad[64];
+    mbedtls_sha1_context ctx;
+    mbedtls_sha1_init(&ctx);
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < 20; ++i) {
+        pad[i] ^= BENCHMARK_KEY[i];
+    }
+    mbedtls_sha1_starts_ret(&ctx);
+    update(&ctx, pad, sizeof(pad));
+    update(&ctx, data, size);
+    finish(&ctx, output);
+    memset(pad, 0x5C, sizeof(pad));
+    for (size_t i = 0; i < 20; ++i) {
+        pad[i] ^= BENCHMARK_KEY[i];
+    }
+    mbedtls_sha1_starts_ret(&ctx);
+    update(&ctx, pad, sizeof(pad));
+    update(&ctx, output, 20);
+    finish(&ctx, output);
+    mbedtls_sha1_free(&ctx);
+}
+
+static void hmacSha1Original(const uint8_t *data, size_t size, uint8_t *output) {
+    hmacSha1(__real_mbedtls_sha1_update_ret, __real_mbedtls_sha1_finish_ret, data, size, output);
+}
+
+static void hmacSha1Hooked(const uint8_t *data, size_t size, uint8_t *output) {
+    hmacSha1(mbedtls_sha1_update_ret, mbedtls_sha1_finish_ret, data, size, output);
+}
+
+typedef int (*Blake2spUpdateFunction)(blake2sp_state *S, const void *pin, size_t inlen);
+
+// The RAR5 reader feeds BLAKE2sp with whatever its decompressor produced, so the data is split
+// into uneven chunks here to also exercise the unaligned head and tail of each update.
+static void blake2sp(Blake2spUpdateFunction update, const uint8_t *data, size_t size,
+                     uint8_t output[BLAKE2S_OUTBYTES]) {
+    blake2sp_state state;
+    blake2sp_init(&state, BLAKE2S_OUTBYTES);
+    size_t chunkSize = 65536 - 1;
+    for (size_t offset = 0; offset < size; offset += chunkSize) {
+        update(&state, data + offset, size - offset < chunkSize ? size - offset : chunkSize);
+    }
+    blake2sp_final(&state, output, BLAKE2S_OUTBYTES);
+}
+
+static void blake2spOriginal(const uint8_t *data, size_t size, uint8_t *output) {
+    blake2sp(__real_blake2sp_update, data, size, output);
+}
+
+static void blake2spHooked(const uint8_t *data, size_t size, uint8_t *output) {
+    blake2sp(blake2sp_update, data, size, output);
+}
+
+static void crc32Table(const uint8_t *data, size_t size, uint8_t *output) {
+    uint32_t crc = (uint32_t) archiveTableCrc32(0, data, size);
+    memcpy(output, &crc, sizeof(crc));
+}
+
+static void crc32Zlib(const uint8_t *data, size_t size, uint8_t *output) {
+    uint32_t crc = (uint32_t) crc32(0, data, (uInt) size);
+    memcpy(output, &crc, sizeof(crc));
+}
+
+typedef int (*AddFilterFunction)(struct archive *archive);
+
+// Writes the data as a single raw entry through the filter into memory, the way a Java caller of
+// writeAddFilterB64encode() or writeAddFilterUuencode() would, so that the setup of the filter is
+// included as well.
+static void writeFiltered(AddFilterFunction addFilter, const uint8_t *data, size_t size,
+                          uint8_t *output) {
+    struct archive *archive = archive_write_new();
+    struct archive_entry *entry = archive_entry_new();
+    size_t outputLength = 0;
+    if (archive && entry && archive_write_set_format_raw(archive) == ARCHIVE_OK
+            && addFilter(archive) == ARCHIVE_OK
+            && archive_write_open_memory(archive, output, UU_OUTPUT_SIZE, &outputLength)
+                    == ARCHIVE_OK) {
+        archive_entry_set_pathname(entry, "data");
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_size(entry, (la_int64_t) size);
+        if (archive_write_header(archive, entry) == ARCHIVE_OK) {
+            archive_write_data(archive, data, size);
+        }
+        archive_write_close(archive);
+    }
+    archive_entry_free(entry);
+    archive_write_free(archive);
+}
+
+static void base64Original(const uint8_t *data, size_t size, uint8_t *output) {
+    writeFiltered(__real_archive_write_add_filter_b64encode, data, size, output);
+}
+
+static void base64Hooked(const uint8_t *data, size_t size, uint8_t *output) {
+    writeFiltered(archive_write_add_filter_b64encode, data, size, output);
+}
+
+static void uuencodeOriginal(const uint8_t *data, size_t size, uint8_t *output) {
+    writeFiltered(__real_archive_write_add_filter_uuencode, data, size, output);
+}
+
+static void uuencodeHooked(const uint8_t *data, size_t size, uint8_t *output) {
+    writeFiltered(archive_write_add_filter_uuencode, data, size, output);
+}
+
+// A pax tar of TAR_ENTRY_COUNT empty files that is generated while it's read, so that it doesn't
+// need the 1.5 GiB it would take in memory.
+struct TarStream {
+    uint8_t *entries;
+    size_t entrySize;
+    size_t remainingEntryCount;
+    bool isEndRead;
+};
+
+static la_ssize_t readTarStream(struct archive *archive, void *clientData, const void **buffer) {
+    static const uint8_t END_OF_ARCHIVE[1024];
+    struct TarStream *stream = clientData;
+    if (stream->remainingEntryCount) {
+        size_t entryCount = stream->remainingEntryCount < TAR_ENTRIES_PER_READ
+                ? stream->remainingEntryCount : TAR_ENTRIES_PER_READ;
+        stream->remainingEntryCount -= entryCount;
+        *buffer = stream->entries;
+        return (la_ssize_t) (entryCount * stream->entrySize);
+    }
+    if (!stream->isEndRead) {
+        stream->isEndRead = true;
+        *buffer = END_OF_ARCHIVE;
+        return sizeof(END_OF_ARCHIVE);
+    }
+    return 0;
+}
+
+// Writes a single pax entry, whose ASCII path is too long for a ustar header even when split, so
+// that it's stored as a UTF-8 path record that the reader converts, like deep node_modules paths
+// are.
+static size_t writeTarEntry(const char *path, uint8_t *output, size_t outputSize) {
+    struct archive *archive = archive_write_new();
+    struct archive_entry *entry = archive_entry_new();
+    size_t outputLength = 0;
+    size_t entrySize = 0;
+    // Without blocking, everything written so far has reached the output after the entry.
+    if (archive && entry && archive_write_set_format_pax(archive) == ARCHIVE_OK
+            && archive_write_set_bytes_per_block(archive, 0) == ARCHIVE_OK
+            && archive_write_open_memory(archive, output, outputSize, &outputLength)
+                    == ARCHIVE_OK) {
+        archive_entry_set_pathname(entry, path);
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, 0);
+        if (archive_write_header(archive, entry) == ARCHIVE_OK
+                && archive_write_finish_entry(archive) == ARCHIVE_OK) {
+            entrySize = outputLength;
+        }
+    }
+    archive_entry_free(entry);
+    archive_write_free(archive);
+    return entrySize;
+}
+
+// Returns false if the reader doesn't see every entry with its path.
+static bool runTarHeaderBenchmark(void) {
+    const char *path = "node_modules/.pnpm/@benchmark+package-with-a-long-name@1.0.0/"
+            "node_modules/@benchmark/package-with-a-long-name/node_modules/.pnpm/"
+            "@benchmark+nested-package-with-a-long-name@2.0.0/node_modules/@benchmark/"
+            "nested-package-with-a-long-name/lib/modules/benchmark-module-with-a-long-name.js";
+    uint8_t entry[16 * 1024];
+    size_t entrySize = writeTarEntry(path, entry, sizeof(entry));
+    uint8_t *entries = entrySize ? malloc(entrySize * TAR_ENTRIES_PER_READ) : NULL;
+    if (!entries) {
+        fprintf(stderr, "Tar headers: Failed to write an entry\n");
+        return false;
+    }
+    for (size_t i = 0; i < TAR_ENTRIES_PER_READ; ++i) {
+        memcpy(entries + i * entrySize, entry, entrySize);
+    }
+    struct TarStream stream = {
+        .entries = entries,
+        .entrySize = entrySize,
+        .remainingEntryCount = TAR_ENTRY_COUNT
+    };
+    struct archive *archive = archive_read_new();
+    size_t entryCount = 0;
+    bool isPathEqual = true;
+    int64_t startTime = getMonotonicTimeNanos();
+    if (archive && archive_read_support_format_tar(archive) == ARCHIVE_OK
+            && archive_read_open(archive, &stream, NULL, readTarStream, NULL) == ARCHIVE_OK) {
+        struct archive_entry *archiveEntry;
+        while (archive_read_next_header(archive, &archiveEntry) == ARCHIVE_OK) {
+            const char *entryPath = archive_entry_pathname(archiveEntry);
+            isPathEqual &= entryPath && !strcmp(entryPath, path);
+            ++entryCount;
+        }
+    }
+    int64_t duration = getMonotonicTimeNanos() - startTime;
+    archive_read_free(archive);
+    free(entries);
+    bool isSuccessful = entryCount == TAR_ENTRY_COUNT && isPathEqual;
+    if (isSuccessful) {
+        printf("%-12s %9.0f headers/s\n", "Tar headers", entryCount / (duration / 1e9));
+    } else if (!isPathEqual) {
+        fprintf(stderr, "Tar headers: Path mismatch\n");
+    } else {
+        fprintf(stderr, "Tar headers: Read %zu of %d entries\n", entryCount, TAR_ENTRY_COUNT);
+    }
+    return isSuccessful;
+}
+
+int main(void) {
+    char cpuDispatchDescription[256];
+    getCpuDispatchDescription(cpuDispatchDescription, sizeof(cpuDispatchDescription));
+    printf("%s\n", cpuDispatchDescription);
+    // libarchive starts each CRC with this call, which is also what makes the platform libz check
+    // for its CPU features.
+    crc32(0, Z_NULL, 0);
+    uint8_t *data = malloc(BENCHMARK_DATA_SIZE);
+    if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    // A fixed xorshift sequence, so that runs are comparable.
+    uint32_t random = 0x9E3779B9;
+    for (size_t i = 0; i < BENCHMARK_DATA_SIZE; ++i) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        data[i] = (uint8_t) random;
+    }
+    printf("%-12s %15s %15s %7s\n", "Kernel", "Baseline", "Optimized", "Speedup");
+    bool isSuccessful = true;
+    isSuccessful &= runBenchmark("AES-256-CTR", aes256CtrOriginal, aes256CtrHooked, data,
+                                 BENCHMARK_DATA_SIZE);
+    isSuccessful &= runBenchmark("HMAC-SHA1", hmacSha1Original, hmacSha1Hooked, data, 20);
+    isSuccessful &= runBenchmark("BLAKE2sp", blake2spOriginal, blake2spHooked, data,
+                                 BLAKE2S_OUTBYTES);
+    isSuccessful &= runBenchmark("CRC32", crc32Table, crc32Zlib, data, sizeof(uint32_t));
+    isSuccessful &= runBenchmark("Base64", base64Original, base64Hooked, data, UU_OUTPUT_SIZE);
+    isSuccessful &= runBenchmark("Uuencode", uuencodeOriginal, uuencodeHooked, data,
+                                 UU_OUTPUT_SIZE);
+    isSuccessful &= runTarHeaderBenchmark();
+    free(data);
+    return isSuccessful ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -91,6 +91,10 @@ public class Archive {
     public static final int READ_FORMAT_ENCRYPTION_UNSUPPORTED = -2;
     public static final int READ_FORMAT_ENCRYPTION_DONT_KNOW = -1;
 
+    /** @noinspection PointlessBitwiseExpression*/
+    public static final int SEARCH_IGNORE_CASE = 1 << 0;
+    public static final int SEARCH_FIRST_HIT_PER_ENTRY = 1 << 1;
+
     private static final String ENV_TMPDIR = "TMPDIR";
     private static final String PROPERTY_TMPDIR = "java.io.tmpdir";
 
@@ -101,7 +105,7 @@ public class Archive {
 
     private static void ensureTmpdirEnv() {
         // The TMPDIR environment variable is required for writing formats like 7z which calls
-        // mkstemp().
+        // mkstemp() once its temporary file outgrows the memory limit.
         // /tmp isn't available on Android, and /data/local/tmp is only accessible to Shell, so we
         // need to set it to the app data cache directory, which we have to do manually on older
         // platforms.
@@ -140,7 +144,29 @@ public class Archive {
     @NonNull
     public static native byte[] libzstdVersion();
 
+    /**
+     * Sets the total size up to which the temporary files of the 7z, ISO9660 and xar writers are
+     * kept in memory across all archives, in bytes, or 0 to always use files in {@code TMPDIR}. A
+     * temporary file whose growth would exceed the limit is moved to {@code TMPDIR} transparently.
+     * The default is 32 MiB.
+     */
+    public static native void setTempFileMemoryLimit(long limit);
+
+    /**
+     * Zeroes and drops the keys derived from passphrases for encrypted zip entries, which are
+     * otherwise cached for the life of the process to avoid deriving them again.
+     */
+    public static native void clearKeyDerivationCache();
+
     public static native long readNew() throws ArchiveException;
+    /**
+     * Creates a reader with all filters and formats enabled, the charset and options set, in one
+     * call. This is the same as calling {@link #readNew()}, {@link #setCharset(long, byte[])},
+     * {@link #readSupportFilterAll(long)}, {@link #readSupportFormatAll(long)} and
+     * {@link #readSetOptions(long, byte[])} in order, with {@code null} skipping a setter.
+     */
+    public static native long readNewConfigured(@Nullable byte[] charset,
+            @Nullable byte[] options) throws ArchiveException;
 
     public static native void readSupportFilterAll(long archive) throws ArchiveException;
     public static native void readSupportFilterByCode(long archive, int code)
@@ -316,6 +342,14 @@ public class Archive {
             throws ArchiveException;
     public static native void readOpenFd(long archive, int fd, long blockSize)
             throws ArchiveException;
+    /**
+     * Lists where the compressed data of each entry is in the zip file at {@code fd}, so that it
+     * can be read without decompression, e.g. to serve a deflated entry as is with
+     * {@code Content-Encoding: deflate}. The data is {@link ZipRawEntry#compressedSize} bytes at
+     * {@link ZipRawEntry#dataOffset}, and starts with the encryption header for encrypted entries.
+     */
+    @NonNull
+    public static native ZipRawEntry[] readZipRawEntries(int fd) throws ArchiveException;
 
     public static native long readNextHeader(long archive) throws ArchiveException;
     public static native long readNextHeader2(long archive, long entry) throws ArchiveException;
@@ -331,6 +365,17 @@ public class Archive {
     public static native void readDataSkip(long archive) throws ArchiveException;
     public static native void readDataIntoFd(long archive, int fd) throws ArchiveException;
 
+    /**
+     * Searches the data of the remaining regular file entries for any of the patterns, without
+     * copying the data into Java. Each call returns the next batch of at most {@code maxHits} hits
+     * and continues where the last call with the same patterns and flags left off, or returns
+     * {@code null} once the archive ends. Reading a header in between moves the search on to the
+     * next entry.
+     */
+    @Nullable
+    public static native SearchHit[] search(long archive, @NonNull byte[][] patterns, int flags,
+            int maxHits) throws ArchiveException;
+
     public static native void readSetFormatOption(long archive, @Nullable byte[] module,
             @NonNull byte[] option, @Nullable byte[] value) throws ArchiveException;
     public static native void readSetFilterOption(long archive, @Nullable byte[] module,
@@ -411,6 +456,12 @@ public class Archive {
 
     public static native void writeZipSetCompressionDeflate(long archive) throws ArchiveException;
     public static native void writeZipSetCompressionStore(long archive) throws ArchiveException;
+    /**
+     * Chooses between deflate and store for each regular file by sampling the first 64 KiB of its
+     * data, so that already compressed media and packages are stored instead of deflated. The
+     * header of such an entry is written once the sample is full or the entry is finished.
+     */
+    public static native void writeZipSetCompressionAdaptive(long archive) throws ArchiveException;
 
     public static <T> void writeOpen(long archive, T clientData,
             @Nullable OpenCallback<T> openCallback, @NonNull WriteCallback<T> writeCallback,
@@ -422,6 +473,35 @@ public class Archive {
             @Nullable CloseCallback<T> closeCallback, @Nullable FreeCallback<T> freeCallback)
             throws ArchiveException;
     public static native void writeOpenFd(long archive, int fd) throws ArchiveException;
+    /**
+     * Appends entries to an existing zip file in place, or writes a new zip if the file is empty,
+     * after setting the format to zip. The file descriptor must be readable, writable and seekable.
+     * New entries are written over the old central directory, and a central directory of all
+     * entries is written on close, so the cost is proportional to the new entries. The old central
+     * directory is written back if the archive isn't closed successfully. No filter other than
+     * none may be added.
+     */
+    public static native void writeOpenZipAppendFd(long archive, int fd) throws ArchiveException;
+    /**
+     * Copies entries verbatim from another zip file to an archive opened with
+     * {@link #writeOpenZipAppendFd(long, int)}, after the entries written so far, without
+     * decompressing or decrypting them. Entries are looked up by their raw pathnames, and renamed
+     * to the new pathnames unless {@code newPathnames} or an element of it is null. A non-ASCII new
+     * pathname is flagged as UTF-8 if it is valid UTF-8, and is otherwise taken to be in the legacy
+     * encoding of the source entry. Either all entries are copied or none is.
+     */
+    public static native void writeZipCopyEntries(long archive, int sourceFd,
+            @NonNull byte[][] pathnames, @Nullable byte[][] newPathnames) throws ArchiveException;
+    /**
+     * Aligns the data of stored entries in an archive opened with
+     * {@link #writeOpenZipAppendFd(long, int)} to {@code alignment} bytes, or to
+     * {@code sharedLibraryAlignment} bytes for {@code .so} files unless it's 0, so that they can be
+     * memory mapped, e.g. 4 and 16384 as {@code zipalign -P 16 4} does. Local headers are padded
+     * with the same extra field as zipalign, and copied entries are aligned too. Alignments must be
+     * powers of two up to 32768, and 0 or 1 means no alignment, which is the default.
+     */
+    public static native void writeZipSetAlignment(long archive, int alignment,
+            int sharedLibraryAlignment) throws ArchiveException;
     public static native void writeOpenFileName(long archive, @NonNull byte[] fileName)
             throws ArchiveException;
     public static native void writeOpenMemory(long archive, @NonNull ByteBuffer buffer)
@@ -429,6 +509,25 @@ public class Archive {
     public static native void writeOpenMemoryUnsafe(long archive, long buffer, long bufferSize)
             throws ArchiveException;
     public static native long writeOpenMemoryGetUsed(long archive) throws ArchiveException;
+    /**
+     * Opens the archive for writing into native memory that grows as needed, in segments that are
+     * never moved. The written data can be read with
+     * {@link #writeOpenGrowableMemoryGetBuffers(long)} without copying, or with
+     * {@link #writeOpenGrowableMemoryToByteArray(long)} in one copy, and is freed with the archive.
+     */
+    public static native void writeOpenGrowableMemory(long archive) throws ArchiveException;
+    public static native long writeOpenGrowableMemoryGetUsed(long archive)
+            throws ArchiveException;
+    /**
+     * Returns read-only direct buffers over the written data in order, which must not be used after
+     * the archive is freed.
+     */
+    @NonNull
+    public static native ByteBuffer[] writeOpenGrowableMemoryGetBuffers(long archive)
+            throws ArchiveException;
+    @NonNull
+    public static native byte[] writeOpenGrowableMemoryToByteArray(long archive)
+            throws ArchiveException;
 
     public static native void writeHeader(long archive, long entry) throws ArchiveException;
     public static native void writeData(long archive, @NonNull ByteBuffer buffer)
@@ -478,6 +577,24 @@ public class Archive {
     public static native void setCharset(long archive, @Nullable byte[] charset)
             throws ArchiveException;
 
+    /**
+     * Sets the budget for large native allocations made on behalf of this archive, in bytes, or 0
+     * for no budget. This is the memory limit for all decoders, e.g. xz and lzma dictionaries, zstd
+     * and lz4 windows, PPMd models and LZX windows, and can be changed at any time.
+     * <p>
+     * An allocation that would exceed the budget fails inside libarchive, and the call that made
+     * it throws an {@link ArchiveException} with {@link android.system.OsConstants#ENOMEM} as its
+     * code, whatever error the decoder itself reported.
+     */
+    public static native void setMemoryBudget(long archive, long budget);
+    /**
+     * Returns the current and peak size of the large native allocations made on behalf of this
+     * archive. The current size includes the last freed block of 2 MiB or more, which is kept for
+     * reuse until it's needed again or an allocation would otherwise exceed the budget.
+     */
+    @NonNull
+    public static native MemoryStats memoryStats(long archive);
+
     public interface ReadCallback<T> {
         @Nullable
         ByteBuffer onRead(long archive, T clientData) throws ArchiveException;
@@ -516,4 +633,49 @@ public class Archive {
         @Nullable
         byte[] onPassphrase(long archive, T clientData) throws ArchiveException;
     }
+
+    public static class SearchHit {
+        @NonNull
+        public final byte[] pathname;
+        public final long offset;
+        public final int patternIndex;
+
+        public SearchHit(@NonNull byte[] pathname, long offset, int patternIndex) {
+            this.pathname = pathname;
+            this.offset = offset;
+            this.patternIndex = patternIndex;
+        }
+    }
+
+    public static class MemoryStats {
+        public final long currentBytes;
+        public final long peakBytes;
+
+        public MemoryStats(long currentBytes, long peakBytes) {
+            this.currentBytes = currentBytes;
+            this.peakBytes = peakBytes;
+        }
+    }
+
+    public static class ZipRawEntry {
+        @NonNull
+        public final byte[] pathname;
+        public final int method;
+        public final int flags;
+        public final int crc32;
+        public final long compressedSize;
+        public final long uncompressedSize;
+        public final long dataOffset;
+
+        public ZipRawEntry(@NonNull byte[] pathname, int method, int flags, int crc32,
+                long compressedSize, long uncompressedSize, long dataOffset) {
+            this.pathname = pathname;
+            this.method = method;
+            this.flags = flags;
+            this.crc32 = crc32;
+            this.compressedSize = compressedSize;
+            this.uncompressedSize = uncompressedSize;
+            this.dataOffset = dataOffset;
+        }
+    }
 }
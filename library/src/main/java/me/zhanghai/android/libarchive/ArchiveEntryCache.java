@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package me.zhanghai.android.libarchive;
+
+import java.nio.ByteBuffer;
+
+import androidx.annotation.NonNull;
+import androidx.annotation.Nullable;
+
+/**
+ * A process-wide LRU cache of decompressed entry content, for viewers that read the same entries
+ * again and again, e.g. pages of a comic book.
+ * <p>
+ * Content is keyed by an archive key chosen by the app, which should change whenever the archive
+ * may have changed, e.g. its path with its size and modification time, and the entry pathname.
+ */
+public class ArchiveEntryCache {
+
+    static {
+        Archive.staticInit();
+    }
+
+    private ArchiveEntryCache() {}
+
+    /**
+     * Sets the memory limit for content kept as is, and the one for content evicted from there and
+     * kept compressed with LZ4, in bytes. Both are 0 by default, which disables the cache.
+     */
+    public static native void setLimits(long memoryLimit, long compressedMemoryLimit);
+
+    /**
+     * Copies the remaining content of the buffer into the cache, and returns whether it was cached.
+     */
+    public static native boolean put(@NonNull byte[] archiveKey, @NonNull byte[] pathname,
+            @NonNull ByteBuffer content) throws ArchiveException;
+
+    /**
+     * Reads the rest of the data of the current entry of the archive into the cache, and returns
+     * whether it was cached, which it isn't if it's larger than {@code maxSize} unless that is
+     * negative, or larger than the memory limit. Reading stops once either is exceeded, and nothing
+     * is read while the cache is disabled. This can be called on a background thread with a
+     * separate archive to prefetch the entries that are likely to be read next.
+     */
+    public static native boolean putData(@NonNull byte[] archiveKey, @NonNull byte[] pathname,
+            long archive, long maxSize) throws ArchiveException;
+
+    /**
+     * Returns a new direct buffer with the cached content, or {@code null} if it isn't cached.
+     */
+    @Nullable
+    public static native ByteBuffer get(@NonNull byte[] archiveKey, @NonNull byte[] pathname)
+            throws ArchiveException;
+
+    /**
+     * Removes all content for the archive key, or all content if it is {@code null}.
+     */
+    public static native void invalidate(@Nullable byte[] archiveKey) throws ArchiveException;
+}
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -25,6 +28,16 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "archive-memory.h"
+#include "content-matcher.h"
+#include "cpu-features.h"
+#include "entry-cache.h"
+#include "memory-temp-file.h"
+#include "output-temp-file.h"
+#include "pbkdf2-cache.h"
+#include "zip-append.h"
+#include "zip-format.h"
+
 #define ALOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 #define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -40,6 +53,11 @@ struct ArchiveJniData {
     jobject writeOpenMemoryJavaBuffer;
     jint writeOpenMemoryPosition;
     size_t writeOpenMemoryUsed;
+    struct GrowableMemory *writeOpenGrowableMemory;
+    struct ZipAppend *writeOpenZipAppend;
+    uint32_t zipAlignment;
+    uint32_t zipSharedLibraryAlignment;
+    struct AdaptiveZip *adaptiveZip;
     bool hasReadClientData;
     jobject writeClientData;
     jobject readCallback;
@@ -55,6 +73,9 @@ struct ArchiveJniData {
     jobject passphraseClientData;
     jobject passphraseCallback;
     char *passphrase;
+    struct ArchiveSearch *search;
+    // Outlives the rest of the data until archive_free() returns.
+    struct ArchiveMemory *memory;
 };
 
 static char *mallocStringFromBytes(JNIEnv *env, jbyteArray javaBytes) {
@@ -87,6 +108,98 @@ static jbyteArray newBytesFromString(JNIEnv *env, const char *string) {
     return bytes;
 }
 
+static bool isAscii(const char *string, size_t length) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, string + i, sizeof(word));
+        if (word & 0x8080808080808080) {
+            return false;
+        }
+    }
+    for (; i < length; ++i) {
+        if (string[i] & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decodes standard UTF-8 into UTF-16, replacing malformed sequences with U+FFFD. The output never
+// has more code units than the input has bytes.
+static size_t decodeUtf8(const char *string, size_t length, jchar *chars) {
+    const uint8_t *bytes = (const uint8_t *) string;
+    size_t charsLength = 0;
+    size_t i = 0;
+    while (i < length) {
+        uint32_t codePoint = bytes[i];
+        if (codePoint < 0x80) {
+            chars[charsLength++] = (jchar) codePoint;
+            ++i;
+            continue;
+        }
+        size_t sequenceLength;
+        uint32_t minCodePoint;
+        if ((codePoint & 0xE0) == 0xC0) {
+            sequenceLength = 2;
+            codePoint &= 0x1F;
+            minCodePoint = 0x80;
+        } else if ((codePoint & 0xF0) == 0xE0) {
+            sequenceLength = 3;
+            codePoint &= 0x0F;
+            minCodePoint = 0x800;
+        } else if ((codePoint & 0xF8) == 0xF0) {
+            sequenceLength = 4;
+            codePoint &= 0x07;
+            minCodePoint = 0x10000;
+        } else {
+            chars[charsLength++] = 0xFFFD;
+            ++i;
+            continue;
+        }
+        size_t j = 1;
+        for (; j < sequenceLength && i + j < length && (bytes[i + j] & 0xC0) == 0x80; ++j) {
+            codePoint = (codePoint << 6) | (bytes[i + j] & 0x3F);
+        }
+        i += j;
+        if (j < sequenceLength || codePoint < minCodePoint || codePoint > 0x10FFFF
+                || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+            chars[charsLength++] = 0xFFFD;
+        } else if (codePoint >= 0x10000) {
+            codePoint -= 0x10000;
+            chars[charsLength++] = (jchar) (0xD800 | (codePoint >> 10));
+            chars[charsLength++] = (jchar) (0xDC00 | (codePoint & 0x3FF));
+        } else {
+            chars[charsLength++] = (jchar) codePoint;
+        }
+    }
+    return charsLength;
+}
+
+// NewStringUTF() expects Modified UTF-8, which encodes supplementary characters as two 3-byte
+// surrogates and may abort on anything else, so only use it for ASCII strings.
+static jstring newStringFromUtf8(JNIEnv *env, const char *string) {
+    if (!string) {
+        return NULL;
+    }
+    size_t length = strlen(string);
+    if (isAscii(string, length)) {
+        return (*env)->NewStringUTF(env, string);
+    }
+    jchar stackChars[256];
+    jchar *chars = length <= sizeof(stackChars) / sizeof(*stackChars) ? stackChars
+            : malloc(length * sizeof(*chars));
+    if (!chars) {
+        return NULL;
+    }
+    size_t charsLength = decodeUtf8(string, length, chars);
+    jstring javaString = (*env)->NewString(env, chars, (jsize) charsLength);
+    if (chars != stackChars) {
+        free(chars);
+    }
+    return javaString;
+}
+
 static char **mallocStringArrayFromBytesArray(JNIEnv *env, jobjectArray bytesArray) {
     jsize length = (*env)->GetArrayLength(env, bytesArray);
     char **stringArray = malloc((length + 1) * sizeof(*stringArray));
@@ -136,10 +249,23 @@ static jmethodID findMethod(JNIEnv *env, jclass clazz, const char *name, const c
     return method;
 }
 
+static jmethodID findStaticMethod(JNIEnv *env, jclass clazz, const char *name,
+        const char *signature) {
+    jmethodID method = (*env)->GetStaticMethodID(env, clazz, name, signature);
+    if (!method) {
+        ALOGE("Failed to find static method '%s' '%s'", name, signature);
+        abort();
+    }
+    return method;
+}
+
 static JavaVM *gVm;
 
 JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
     gVm = vm;
+    char cpuDispatchDescription[128];
+    getCpuDispatchDescription(cpuDispatchDescription, sizeof(cpuDispatchDescription));
+    ALOGI("CPU dispatch: %s", cpuDispatchDescription);
     return JNI_VERSION_1_6;
 }
 
@@ -236,7 +362,7 @@ static void throwArchiveException(JNIEnv* env, int code, const char *message) {
     }
     jstring javaMessage = NULL;
     if (message) {
-        javaMessage = (*env)->NewStringUTF(env, message);
+        javaMessage = newStringFromUtf8(env, message);
         if (!javaMessage) {
             (*env)->ExceptionDescribe(env);
             (*env)->ExceptionClear(env);
@@ -260,6 +386,10 @@ static void throwArchiveException(JNIEnv* env, int code, const char *message) {
 
 static void throwArchiveExceptionFromError(JNIEnv* env, struct archive *archive) {
     int code = archive_errno(archive);
+    // Decoders report a failed allocation in their own ways, e.g. zstd with ARCHIVE_ERRNO_MISC.
+    if (archiveMemoryTakeBudgetExceeded()) {
+        code = ENOMEM;
+    }
     const char *message = archive_error_string(archive);
     throwArchiveException(env, code, message);
 }
@@ -841,10 +971,32 @@ static bool mallocArchiveJniData(JNIEnv* env, struct archive *archive) {
     if (!jniData) {
         return false;
     }
+    jniData->memory = archiveMemoryNew();
+    if (!jniData->memory) {
+        free(jniData);
+        return false;
+    }
     archive_set_user_data(archive, jniData);
     return true;
 }
 
+static struct ArchiveMemory *getArchiveMemory(struct archive *archive) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    return jniData->memory;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_setTempFileMemoryLimit(
+        JNIEnv* env, jclass clazz, jlong limit) {
+    setMemoryTempFileLimit(limit > 0 ? (size_t) limit : 0);
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_clearKeyDerivationCache(
+        JNIEnv* env, jclass clazz) {
+    pbkdf2CacheClear();
+}
+
 JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readNew(
         JNIEnv* env, jclass clazz) {
@@ -861,10 +1013,64 @@ Java_me_zhanghai_android_libarchive_Archive_readNew(
     return (jlong) archive;
 }
 
+JNIEXPORT jlong JNICALL
+Java_me_zhanghai_android_libarchive_Archive_readNewConfigured(
+        JNIEnv* env, jclass clazz, jbyteArray javaCharset, jbyteArray javaOptions) {
+    char *charset = mallocStringFromBytes(env, javaCharset);
+    char *options = mallocStringFromBytes(env, javaOptions);
+    if ((javaCharset && !charset) || (javaOptions && !options)) {
+        free(charset);
+        free(options);
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
+        return (jlong) NULL;
+    }
+    struct archive *archive = archive_read_new();
+    if (!archive) {
+        free(charset);
+        free(options);
+        throwArchiveException(env, ARCHIVE_FATAL, "archive_read_new");
+        return (jlong) NULL;
+    }
+    if (!mallocArchiveJniData(env, archive)) {
+        archive_read_free(archive);
+        free(charset);
+        free(options);
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocArchiveJniData");
+        return (jlong) NULL;
+    }
+    struct ArchiveMemory *memory = getArchiveMemory(archive);
+    ARCHIVE_MEMORY_SCOPE(memory);
+    int errorCode = ARCHIVE_OK;
+    if (charset) {
+        errorCode = archive_set_charset(archive, charset);
+    }
+    if (!errorCode) {
+        errorCode = archive_read_support_filter_all(archive);
+    }
+    if (!errorCode) {
+        errorCode = archive_read_support_format_all(archive);
+    }
+    if (!errorCode && options) {
+        errorCode = archive_read_set_options(archive, options);
+    }
+    free(charset);
+    free(options);
+    if (errorCode) {
+        throwArchiveExceptionFromError(env, archive);
+        // Nothing but the memory has been set on the JNI data yet.
+        free(archive_get_user_data(archive));
+        archive_read_free(archive);
+        archiveMemoryFree(memory);
+        return (jlong) NULL;
+    }
+    return (jlong) archive;
+}
+
 JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFilterAll(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_filter_all(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -875,6 +1081,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFilterByCode(
         JNIEnv* env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_filter_by_code(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -886,6 +1093,7 @@ Java_me_zhanghai_android_libarchive_Archive_readSupportFilterProgramSignature(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaCommand,
         jbyteArray javaSignature) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *command = mallocStringFromBytes(env, javaCommand);
     if (!command) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -906,6 +1114,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFormatAll(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_format_all(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -916,6 +1125,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFormatByCode(
         JNIEnv* env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_format_by_code(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -926,6 +1136,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFormatZipStreamable(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_format_zip_streamable(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -936,6 +1147,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSupportFormatZipSeekable(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_support_format_zip_seekable(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -946,6 +1158,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetFormat(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_set_format(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -956,6 +1169,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readAppendFilter(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_append_filter(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -967,6 +1181,7 @@ Java_me_zhanghai_android_libarchive_Archive_readAppendFilterProgramSignature(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaCommand,
         jbyteArray javaSignature) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *command = mallocStringFromBytes(env, javaCommand);
     if (!command) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1005,6 +1220,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetOpenCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1067,6 +1283,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetReadCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1108,6 +1325,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetSeekCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1150,6 +1368,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetSkipCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1189,6 +1408,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetCloseCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1228,6 +1448,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetSwitchCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject javaCallbackRef = (*env)->NewGlobalRef(env, javaCallback);
     if (javaCallback && !javaCallbackRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1249,6 +1470,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetCallbackData2(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData, jint index) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1275,6 +1497,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readAddCallbackData(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData, jint index) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1294,6 +1517,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readAppendCallbackData(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1313,6 +1537,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readOpen1(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_open1(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1323,6 +1548,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readOpenFileName(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaFileName, jlong blockSize) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *fileName = mallocStringFromBytes(env, javaFileName);
     if (javaFileName && !fileName) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1340,6 +1566,7 @@ Java_me_zhanghai_android_libarchive_Archive_readOpenFileNames(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobjectArray javaFileNames,
         jlong blockSize) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const char **fileNames = (const char **) mallocStringArrayFromBytesArray(env, javaFileNames);
     if (!fileNames) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringArrayFromBytesArray");
@@ -1356,6 +1583,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readOpenMemory(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaBuffer) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct ArchiveJniData *jniData = archive_get_user_data(archive);
     if (jniData->openMemoryArray) {
         (*env)->ReleaseByteArrayElements(env, jniData->openMemoryJavaArray,
@@ -1384,6 +1612,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readOpenMemoryUnsafe(
         JNIEnv *env, jclass clazz, jlong javaArchive, jlong javaBuffer, jlong bufferSize) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const void *buffer = (const void *) javaBuffer;
     int errorCode = archive_read_open_memory(archive, buffer, bufferSize);
     if (errorCode) {
@@ -1395,6 +1624,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readOpenFd(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint fd, jlong blockSize) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_open_fd(archive, fd, blockSize);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1405,6 +1635,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readNextHeader(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct archive_entry *entry = NULL;
     int errorCode = archive_read_next_header(archive, &entry);
     if (errorCode) {
@@ -1420,6 +1651,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readNextHeader2(
         JNIEnv *env, jclass clazz, jlong javaArchive, jlong javaEntry) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     int errorCode = archive_read_next_header2(archive, entry);
     if (errorCode) {
@@ -1435,6 +1667,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readHeaderPosition(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     la_int64_t position = archive_read_header_position(archive);
     if (position < 0) {
         throwArchiveExceptionFromError(env, archive);
@@ -1447,6 +1680,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readHasEncryptedEntries(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_read_has_encrypted_entries(archive);
 }
 
@@ -1454,6 +1688,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readFormatCapabilities(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_read_format_capabilities(archive);
 }
 
@@ -1461,6 +1696,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readData(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaBuffer) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jint position = 0;
     jbyteArray javaArray = NULL;
     jbyte *array = NULL;
@@ -1491,6 +1727,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_seekData(
         JNIEnv *env, jclass clazz, jlong javaArchive, jlong offset, jint whence) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     la_int64_t position = archive_seek_data(archive, offset, whence);
     if (position < 0) {
         throwArchiveExceptionFromError(env, archive);
@@ -1503,6 +1740,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readDataSkip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_data_skip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1513,17 +1751,385 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readDataIntoFd(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint fd) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_data_into_fd(archive, fd);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
 }
 
+#define SEARCH_IGNORE_CASE (1 << 0)
+#define SEARCH_FIRST_HIT_PER_ENTRY (1 << 1)
+
+struct ArchiveSearch {
+    // The flags and the patterns that the matcher was built from, to detect a new search.
+    void *key;
+    size_t keySize;
+    struct ContentMatcher *matcher;
+    bool isEof;
+    // archive_file_count() for the entry being searched, or -1 between entries.
+    int entryFileCount;
+    char *entryPathname;
+    bool isEntryPathnameInHits;
+    // The rest of the current data block, and its offset in the entry.
+    const uint8_t *block;
+    size_t blockSize;
+    int64_t blockOffset;
+    uint8_t *blockCopy;
+    size_t blockCopyCapacity;
+    uint32_t state;
+    // The next match to report at the current position, or 0.
+    uint32_t output;
+};
+
+struct ArchiveSearchHit {
+    size_t pathnameIndex;
+    size_t pattern;
+    int64_t offset;
+};
+
+struct ArchiveSearchHits {
+    struct ArchiveSearchHit *hits;
+    size_t hitCount;
+    size_t hitCapacity;
+    char **pathnames;
+    size_t pathnameCount;
+    size_t pathnameCapacity;
+};
+
+static void freeArchiveSearch(struct ArchiveSearch *search) {
+    if (!search) {
+        return;
+    }
+    free(search->key);
+    contentMatcherFree(search->matcher);
+    free(search->entryPathname);
+    free(search->blockCopy);
+    free(search);
+}
+
+static void freeArchiveSearchHits(struct ArchiveSearchHits *hits) {
+    free(hits->hits);
+    for (size_t i = 0; i < hits->pathnameCount; ++i) {
+        free(hits->pathnames[i]);
+    }
+    free(hits->pathnames);
+}
+
+static bool growArray(void **array, size_t *capacity, size_t count, size_t elementSize) {
+    if (count < *capacity) {
+        return true;
+    }
+    size_t newCapacity = *capacity ? *capacity * 2 : 16;
+    void *newArray = realloc(*array, newCapacity * elementSize);
+    if (!newArray) {
+        return false;
+    }
+    *array = newArray;
+    *capacity = newCapacity;
+    return true;
+}
+
+// The key is the flags followed by the length and the bytes of each pattern.
+static void *mallocArchiveSearchKey(JNIEnv *env, jobjectArray javaPatterns, jint flags,
+        size_t *outKeySize) {
+    jsize patternCount = (*env)->GetArrayLength(env, javaPatterns);
+    size_t keySize = sizeof(flags);
+    for (jsize i = 0; i < patternCount; ++i) {
+        jbyteArray javaPattern = (*env)->GetObjectArrayElement(env, javaPatterns, i);
+        if (!javaPattern) {
+            return NULL;
+        }
+        keySize += sizeof(uint32_t) + (*env)->GetArrayLength(env, javaPattern);
+        (*env)->DeleteLocalRef(env, javaPattern);
+    }
+    uint8_t *key = malloc(keySize);
+    if (!key) {
+        return NULL;
+    }
+    memcpy(key, &flags, sizeof(flags));
+    size_t offset = sizeof(flags);
+    for (jsize i = 0; i < patternCount; ++i) {
+        jbyteArray javaPattern = (*env)->GetObjectArrayElement(env, javaPatterns, i);
+        uint32_t length = (*env)->GetArrayLength(env, javaPattern);
+        memcpy(key + offset, &length, sizeof(length));
+        offset += sizeof(length);
+        (*env)->GetByteArrayRegion(env, javaPattern, 0, (jsize) length, (jbyte *) (key + offset));
+        offset += length;
+        (*env)->DeleteLocalRef(env, javaPattern);
+    }
+    *outKeySize = keySize;
+    return key;
+}
+
+static struct ArchiveSearch *newArchiveSearch(void *key, size_t keySize, size_t patternCount) {
+    struct ArchiveSearch *search = calloc(1, sizeof(*search));
+    const uint8_t **patterns = malloc(patternCount * sizeof(*patterns));
+    size_t *patternLengths = malloc(patternCount * sizeof(*patternLengths));
+    if (!search || !patterns || !patternLengths) {
+        free(search);
+        free(patterns);
+        free(patternLengths);
+        return NULL;
+    }
+    const uint8_t *keyBytes = key;
+    size_t offset = sizeof(jint);
+    for (size_t i = 0; i < patternCount; ++i) {
+        uint32_t length;
+        memcpy(&length, keyBytes + offset, sizeof(length));
+        offset += sizeof(length);
+        patterns[i] = keyBytes + offset;
+        patternLengths[i] = length;
+        offset += length;
+    }
+    jint flags;
+    memcpy(&flags, key, sizeof(flags));
+    search->matcher = contentMatcherNew(patterns, patternLengths, patternCount,
+            flags & SEARCH_IGNORE_CASE);
+    free(patterns);
+    free(patternLengths);
+    if (!search->matcher) {
+        free(search);
+        return NULL;
+    }
+    search->key = key;
+    search->keySize = keySize;
+    search->entryFileCount = -1;
+    return search;
+}
+
+static bool addArchiveSearchHit(struct ArchiveSearch *search, struct ArchiveSearchHits *hits,
+        size_t pattern) {
+    if (!search->isEntryPathnameInHits) {
+        if (!growArray((void **) &hits->pathnames, &hits->pathnameCapacity, hits->pathnameCount,
+                sizeof(*hits->pathnames))) {
+            return false;
+        }
+        char *pathname = strdup(search->entryPathname);
+        if (!pathname) {
+            return false;
+        }
+        hits->pathnames[hits->pathnameCount++] = pathname;
+        search->isEntryPathnameInHits = true;
+    }
+    if (!growArray((void **) &hits->hits, &hits->hitCapacity, hits->hitCount,
+            sizeof(*hits->hits))) {
+        return false;
+    }
+    struct ArchiveSearchHit *hit = &hits->hits[hits->hitCount++];
+    hit->pathnameIndex = hits->pathnameCount - 1;
+    hit->pattern = pattern;
+    hit->offset = search->blockOffset
+            - (int64_t) contentMatcherGetPatternLength(search->matcher, pattern);
+    return true;
+}
+
+// A data block is only valid until the next read, which may happen outside of the search before
+// it continues, so the unscanned rest of the block is copied when a search call returns.
+static bool copyArchiveSearchBlock(struct ArchiveSearch *search) {
+    if (search->blockSize > search->blockCopyCapacity) {
+        uint8_t *blockCopy = malloc(search->blockSize);
+        if (!blockCopy) {
+            return false;
+        }
+        free(search->blockCopy);
+        search->blockCopy = blockCopy;
+        search->blockCopyCapacity = search->blockSize;
+    }
+    memmove(search->blockCopy, search->block, search->blockSize);
+    search->block = search->blockCopy;
+    return true;
+}
+
+// Reads entries and their data until maxHits hits are found or the archive ends, and keeps the
+// position in the search so that the next call continues from there.
+static int searchArchive(struct archive *archive, struct ArchiveSearch *search, jint flags,
+        jint maxHits, struct ArchiveSearchHits *hits) {
+    search->isEntryPathnameInHits = false;
+    while (!search->isEof && hits->hitCount < (size_t) maxHits) {
+        if (search->entryFileCount == -1
+                || search->entryFileCount != archive_file_count(archive)) {
+            struct archive_entry *entry = NULL;
+            int errorCode = archive_read_next_header(archive, &entry);
+            if (errorCode == ARCHIVE_EOF) {
+                search->isEof = true;
+                break;
+            }
+            if (errorCode) {
+                return errorCode;
+            }
+            search->entryFileCount = -1;
+            if (archive_entry_filetype(entry) != AE_IFREG) {
+                continue;
+            }
+            const char *pathname = archive_entry_pathname(entry);
+            char *entryPathname = strdup(pathname ? pathname : "");
+            if (!entryPathname) {
+                archive_set_error(archive, ARCHIVE_FATAL, "strdup");
+                return ARCHIVE_FATAL;
+            }
+            free(search->entryPathname);
+            search->entryPathname = entryPathname;
+            search->isEntryPathnameInHits = false;
+            search->entryFileCount = archive_file_count(archive);
+            search->block = NULL;
+            search->blockSize = 0;
+            search->blockOffset = 0;
+            search->state = 0;
+            search->output = 0;
+        }
+        if (search->output) {
+            size_t pattern = contentMatcherGetOutputPattern(search->matcher, search->output);
+            if (!addArchiveSearchHit(search, hits, pattern)) {
+                archive_set_error(archive, ARCHIVE_FATAL, "addArchiveSearchHit");
+                return ARCHIVE_FATAL;
+            }
+            if (flags & SEARCH_FIRST_HIT_PER_ENTRY) {
+                // The rest of the data is skipped by the next archive_read_next_header().
+                search->entryFileCount = -1;
+            } else {
+                search->output = contentMatcherGetNextOutput(search->matcher, search->output);
+            }
+            continue;
+        }
+        if (!search->blockSize) {
+            const void *block = NULL;
+            size_t blockSize = 0;
+            la_int64_t blockOffset = 0;
+            int errorCode = archive_read_data_block(archive, &block, &blockSize, &blockOffset);
+            if (errorCode == ARCHIVE_EOF) {
+                search->entryFileCount = -1;
+                continue;
+            }
+            if (errorCode != ARCHIVE_OK && errorCode != ARCHIVE_WARN) {
+                return errorCode;
+            }
+            // A hole in a sparse entry breaks any partial match.
+            if (blockOffset != search->blockOffset) {
+                search->state = 0;
+            }
+            search->block = block;
+            search->blockSize = blockSize;
+            search->blockOffset = blockOffset;
+            if (!blockSize) {
+                continue;
+            }
+        }
+        size_t scannedSize = contentMatcherScan(search->matcher, &search->state, search->block,
+                search->blockSize);
+        search->block += scannedSize;
+        search->blockSize -= scannedSize;
+        search->blockOffset += (int64_t) scannedSize;
+        search->output = contentMatcherGetFirstOutput(search->matcher, search->state);
+    }
+    if (search->entryFileCount != -1 && search->blockSize && !copyArchiveSearchBlock(search)) {
+        archive_set_error(archive, ARCHIVE_FATAL, "copyArchiveSearchBlock");
+        return ARCHIVE_FATAL;
+    }
+    return ARCHIVE_OK;
+}
+
+static jclass getArchiveSearchHitClass(JNIEnv *env) {
+    static jclass clazz = NULL;
+    if (!clazz) {
+        clazz = findClass(env, "me/zhanghai/android/libarchive/Archive$SearchHit");
+    }
+    return clazz;
+}
+
+static jobjectArray newArchiveSearchHitArray(JNIEnv *env, const struct ArchiveSearchHits *hits) {
+    jclass clazz = getArchiveSearchHitClass(env);
+    static jmethodID constructor = NULL;
+    if (!constructor) {
+        constructor = findMethod(env, clazz, "<init>", "([BJI)V");
+    }
+    jobjectArray javaHits = (*env)->NewObjectArray(env, (jsize) hits->hitCount, clazz, NULL);
+    if (!javaHits) {
+        return NULL;
+    }
+    jbyteArray javaPathname = NULL;
+    size_t pathnameIndex = 0;
+    for (size_t i = 0; i < hits->hitCount; ++i) {
+        const struct ArchiveSearchHit *hit = &hits->hits[i];
+        if (!javaPathname || hit->pathnameIndex != pathnameIndex) {
+            (*env)->DeleteLocalRef(env, javaPathname);
+            pathnameIndex = hit->pathnameIndex;
+            javaPathname = newBytesFromString(env, hits->pathnames[pathnameIndex]);
+            if (!javaPathname) {
+                return NULL;
+            }
+        }
+        jobject javaHit = (*env)->NewObject(env, clazz, constructor, javaPathname,
+                (jlong) hit->offset, (jint) hit->pattern);
+        if (!javaHit) {
+            return NULL;
+        }
+        (*env)->SetObjectArrayElement(env, javaHits, (jsize) i, javaHit);
+        (*env)->DeleteLocalRef(env, javaHit);
+    }
+    (*env)->DeleteLocalRef(env, javaPathname);
+    return javaHits;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_me_zhanghai_android_libarchive_Archive_search(
+        JNIEnv *env, jclass clazz, jlong javaArchive, jobjectArray javaPatterns, jint flags,
+        jint maxHits) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (maxHits <= 0) {
+        throwArchiveException(env, ARCHIVE_FATAL, "maxHits");
+        return NULL;
+    }
+    size_t keySize = 0;
+    void *key = mallocArchiveSearchKey(env, javaPatterns, flags, &keySize);
+    if (!key) {
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocArchiveSearchKey");
+        return NULL;
+    }
+    struct ArchiveSearch *search = jniData->search;
+    if (search && search->keySize == keySize && !memcmp(search->key, key, keySize)) {
+        free(key);
+    } else {
+        jsize patternCount = (*env)->GetArrayLength(env, javaPatterns);
+        search = newArchiveSearch(key, keySize, patternCount);
+        if (!search) {
+            free(key);
+            throwArchiveException(env, ARCHIVE_FATAL, "newArchiveSearch");
+            return NULL;
+        }
+        freeArchiveSearch(jniData->search);
+        jniData->search = search;
+    }
+    if (search->isEof) {
+        return NULL;
+    }
+    struct ArchiveSearchHits hits = {};
+    int errorCode = searchArchive(archive, search, flags, maxHits, &hits);
+    if (errorCode) {
+        freeArchiveSearchHits(&hits);
+        throwArchiveExceptionFromError(env, archive);
+        return NULL;
+    }
+    if (!hits.hitCount && search->isEof) {
+        freeArchiveSearchHits(&hits);
+        return NULL;
+    }
+    jobjectArray javaHits = newArchiveSearchHitArray(env, &hits);
+    freeArchiveSearchHits(&hits);
+    if (!javaHits) {
+        throwArchiveException(env, ARCHIVE_FATAL, "newArchiveSearchHitArray");
+    }
+    return javaHits;
+}
+
 JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetFormatOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1553,6 +2159,7 @@ Java_me_zhanghai_android_libarchive_Archive_readSetFilterOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1582,6 +2189,7 @@ Java_me_zhanghai_android_libarchive_Archive_readSetOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1610,6 +2218,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetOptions(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaOptions) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *options = mallocStringFromBytes(env, javaOptions);
     if (javaOptions && !options) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1626,6 +2235,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readAddPassphrase(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaPassphrase) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *passphrase = mallocStringFromBytes(env, javaPassphrase);
     if (javaPassphrase && !passphrase) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1670,6 +2280,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readSetPassphraseCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -1732,6 +2343,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_readClose(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_read_close(archive);
     closeArchiveJniData(env, archive);
     if (errorCode) {
@@ -1759,6 +2371,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetBytesPerBlock(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint bytesPerBlock) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_bytes_per_block(archive, bytesPerBlock);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1769,6 +2382,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeGetBytesPerBlock(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int bytesPerBlock = archive_write_get_bytes_per_block(archive);
     if (bytesPerBlock < -1) {
         throwArchiveExceptionFromError(env, archive);
@@ -1781,6 +2395,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetBytesInLastBlock(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint bytesInLastBlock) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_bytes_in_last_block(archive, bytesInLastBlock);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1791,6 +2406,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeGetBytesInLastBlock(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int bytesInLastBlock = archive_write_get_bytes_in_last_block(archive);
     if (bytesInLastBlock < -1) {
         throwArchiveExceptionFromError(env, archive);
@@ -1803,6 +2419,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilter(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1813,6 +2430,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterByName(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaName) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *name = mallocStringFromBytes(env, javaName);
     if (javaName && !name) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1829,6 +2447,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterB64encode(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_b64encode(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1839,6 +2458,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterBzip2(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_bzip2(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1849,6 +2469,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterCompress(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_compress(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1859,6 +2480,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterGrzip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_grzip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1869,6 +2491,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterGzip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_gzip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1879,6 +2502,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterLrzip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_lrzip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1889,6 +2513,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterLz4(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_lz4(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1899,6 +2524,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterLzip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_lzip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1909,6 +2535,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterLzma(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_lzma(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1919,6 +2546,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterLzop(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_lzop(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1929,6 +2557,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterNone(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_none(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1939,6 +2568,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterProgram(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaCommand) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *command = mallocStringFromBytes(env, javaCommand);
     if (javaCommand && !command) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -1955,6 +2585,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterUuencode(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_uuencode(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1965,6 +2596,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterXz(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_xz(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1975,6 +2607,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeAddFilterZstd(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_add_filter_zstd(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1985,6 +2618,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormat(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint code) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format(archive, code);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -1995,6 +2629,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatByName(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaName) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *name = mallocStringFromBytes(env, javaName);
     if (javaName && !name) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2011,6 +2646,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormat7zip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_7zip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2021,6 +2657,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatArBsd(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_ar_bsd(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2031,6 +2668,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatArSvr4(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_ar_svr4(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2041,6 +2679,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatCpio(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_cpio(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2051,6 +2690,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatCpioBin(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_cpio_bin(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2061,6 +2701,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatCpioNewc(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_cpio_newc(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2071,6 +2712,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatCpioOdc(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_cpio_odc(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2081,6 +2723,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatCpioPwb(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_cpio_pwb(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2091,6 +2734,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatGnutar(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_gnutar(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2101,6 +2745,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatIso9660(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_iso9660(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2111,6 +2756,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatMtree(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_mtree(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2121,6 +2767,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatMtreeClassic(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_mtree_classic(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2131,6 +2778,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatPax(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_pax(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2141,6 +2789,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatPaxRestricted(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_pax_restricted(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2151,6 +2800,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatRaw(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_raw(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2161,6 +2811,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatShar(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_shar(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2171,6 +2822,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatSharDump(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_shar_dump(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2181,6 +2833,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatUstar(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_ustar(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2191,6 +2844,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatV7tar(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_v7tar(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2201,6 +2855,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatWarc(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_warc(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2211,6 +2866,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatXar(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_xar(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2221,6 +2877,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatZip(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_set_format_zip(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2231,6 +2888,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetFormatFilterByExt(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaFileName) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *fileName = mallocStringFromBytes(env, javaFileName);
     if (javaFileName && !fileName) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2248,6 +2906,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeSetFormatFilterByExtDef(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaFileName,
         jbyteArray javaDefaultExtension) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *fileName = mallocStringFromBytes(env, javaFileName);
     if (javaFileName && !fileName) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2266,11 +2925,168 @@ Java_me_zhanghai_android_libarchive_Archive_writeSetFormatFilterByExtDef(
     }
 }
 
+// Entries are sampled for this many bytes before their compression is chosen.
+#define ADAPTIVE_ZIP_SAMPLE_SIZE (64 * 1024)
+// Order-0 entropy in bits per byte, above which deflate can save only a few percent.
+#define ADAPTIVE_ZIP_STORE_ENTROPY 7.8
+
+struct AdaptiveZip {
+    // The header is held back until the entry's compression is chosen.
+    struct archive_entry *pendingEntry;
+    size_t sampleSize;
+    uint8_t sample[ADAPTIVE_ZIP_SAMPLE_SIZE];
+};
+
+static void freeAdaptiveZip(struct AdaptiveZip *adaptiveZip) {
+    if (!adaptiveZip) {
+        return;
+    }
+    archive_entry_free(adaptiveZip->pendingEntry);
+    free(adaptiveZip);
+}
+
+static double getByteEntropy(const uint8_t *bytes, size_t size) {
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < size; ++i) {
+        ++counts[bytes[i]];
+    }
+    double entropy = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        if (counts[i]) {
+            double probability = (double) counts[i] / size;
+            entropy -= probability * log2(probability);
+        }
+    }
+    return entropy;
+}
+
+// Zip append pads local headers for alignment, so it needs to know where they start.
+static int writeEntryHeader(struct archive *archive, struct archive_entry *entry) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (jniData->writeOpenZipAppend) {
+        int errorCode = archive_write_finish_entry(archive);
+        if (errorCode < ARCHIVE_WARN) {
+            return errorCode;
+        }
+        zipAppendBeginEntry(jniData->writeOpenZipAppend);
+    }
+    return archive_write_header(archive, entry);
+}
+
+static int getWorseErrorCode(int errorCode1, int errorCode2) {
+    return errorCode1 < errorCode2 ? errorCode1 : errorCode2;
+}
+
+// Writes the pending header with the compression chosen from the sample, followed by the sample.
+static int flushAdaptiveZipEntry(struct archive *archive) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    struct AdaptiveZip *adaptiveZip = jniData->adaptiveZip;
+    if (!adaptiveZip || !adaptiveZip->pendingEntry) {
+        return ARCHIVE_OK;
+    }
+    struct archive_entry *entry = adaptiveZip->pendingEntry;
+    adaptiveZip->pendingEntry = NULL;
+    bool isIncompressible = getByteEntropy(adaptiveZip->sample, adaptiveZip->sampleSize)
+            >= ADAPTIVE_ZIP_STORE_ENTROPY;
+    int errorCode = isIncompressible ? archive_write_zip_set_compression_store(archive)
+            : archive_write_zip_set_compression_deflate(archive);
+    if (!errorCode) {
+        errorCode = writeEntryHeader(archive, entry);
+    }
+    archive_entry_free(entry);
+    if (errorCode < ARCHIVE_WARN) {
+        return errorCode;
+    }
+    if (adaptiveZip->sampleSize) {
+        la_ssize_t bytesWritten = archive_write_data(archive, adaptiveZip->sample,
+                adaptiveZip->sampleSize);
+        if (bytesWritten < 0) {
+            return (int) bytesWritten;
+        }
+    }
+    return errorCode;
+}
+
+static void discardAdaptiveZipEntry(struct archive *archive) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    struct AdaptiveZip *adaptiveZip = jniData->adaptiveZip;
+    if (!adaptiveZip) {
+        return;
+    }
+    archive_entry_free(adaptiveZip->pendingEntry);
+    adaptiveZip->pendingEntry = NULL;
+}
+
+static int writeAdaptiveZipHeader(struct archive *archive, struct archive_entry *entry) {
+    int flushErrorCode = flushAdaptiveZipEntry(archive);
+    if (flushErrorCode < ARCHIVE_WARN) {
+        return flushErrorCode;
+    }
+    int errorCode;
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    struct AdaptiveZip *adaptiveZip = jniData->adaptiveZip;
+    if (!adaptiveZip || archive_entry_filetype(entry) != AE_IFREG
+            || (archive_entry_size_is_set(entry) && !archive_entry_size(entry))) {
+        errorCode = writeEntryHeader(archive, entry);
+    } else {
+        adaptiveZip->pendingEntry = archive_entry_clone(entry);
+        if (!adaptiveZip->pendingEntry) {
+            archive_set_error(archive, ENOMEM, "archive_entry_clone");
+            return ARCHIVE_FATAL;
+        }
+        adaptiveZip->sampleSize = 0;
+        errorCode = ARCHIVE_OK;
+    }
+    return getWorseErrorCode(errorCode, flushErrorCode);
+}
+
+static la_ssize_t writeAdaptiveZipData(struct archive *archive, const void *buffer, size_t size) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    struct AdaptiveZip *adaptiveZip = jniData->adaptiveZip;
+    if (!adaptiveZip || !adaptiveZip->pendingEntry) {
+        return archive_write_data(archive, buffer, size);
+    }
+    size_t sampledSize = ADAPTIVE_ZIP_SAMPLE_SIZE - adaptiveZip->sampleSize;
+    if (sampledSize > size) {
+        sampledSize = size;
+    }
+    memcpy(adaptiveZip->sample + adaptiveZip->sampleSize, buffer, sampledSize);
+    adaptiveZip->sampleSize += sampledSize;
+    if (adaptiveZip->sampleSize < ADAPTIVE_ZIP_SAMPLE_SIZE) {
+        return (la_ssize_t) sampledSize;
+    }
+    int errorCode = flushAdaptiveZipEntry(archive);
+    if (errorCode < ARCHIVE_WARN) {
+        return errorCode;
+    }
+    if (sampledSize == size) {
+        return (la_ssize_t) sampledSize;
+    }
+    la_ssize_t bytesWritten = archive_write_data(archive, (const uint8_t *) buffer + sampledSize,
+            size - sampledSize);
+    if (bytesWritten < 0) {
+        return bytesWritten;
+    }
+    return (la_ssize_t) sampledSize + bytesWritten;
+}
+
 JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeZipSetCompressionDeflate(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
-    int errorCode = archive_write_zip_set_compression_deflate(archive);
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    int errorCode = flushAdaptiveZipEntry(archive);
+    if (errorCode >= ARCHIVE_WARN) {
+        errorCode = getWorseErrorCode(errorCode,
+                archive_write_zip_set_compression_deflate(archive));
+    }
+    if (errorCode < ARCHIVE_WARN) {
+        throwArchiveExceptionFromError(env, archive);
+        return;
+    }
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    freeAdaptiveZip(jniData->adaptiveZip);
+    jniData->adaptiveZip = NULL;
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
@@ -2280,12 +3096,48 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeZipSetCompressionStore(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
-    int errorCode = archive_write_zip_set_compression_store(archive);
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    int errorCode = flushAdaptiveZipEntry(archive);
+    if (errorCode >= ARCHIVE_WARN) {
+        errorCode = getWorseErrorCode(errorCode,
+                archive_write_zip_set_compression_store(archive));
+    }
+    if (errorCode < ARCHIVE_WARN) {
+        throwArchiveExceptionFromError(env, archive);
+        return;
+    }
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    freeAdaptiveZip(jniData->adaptiveZip);
+    jniData->adaptiveZip = NULL;
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
 }
 
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeZipSetCompressionAdaptive(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    // Also fails early if the format isn't zip.
+    int errorCode = archive_write_zip_set_compression_deflate(archive);
+    if (errorCode) {
+        throwArchiveExceptionFromError(env, archive);
+        return;
+    }
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (jniData->adaptiveZip) {
+        return;
+    }
+    jniData->adaptiveZip = malloc(sizeof(*jniData->adaptiveZip));
+    if (!jniData->adaptiveZip) {
+        throwArchiveException(env, ARCHIVE_FATAL, "malloc");
+        return;
+    }
+    jniData->adaptiveZip->pendingEntry = NULL;
+    jniData->adaptiveZip->sampleSize = 0;
+}
+
 static la_ssize_t archiveWriteCallback(struct archive *archive, void *client_data,
         const void *buffer, size_t length) {
     JNIEnv *env = getEnv();
@@ -2344,6 +3196,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeOpen2(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData, jobject javaOpenCallback,
         jobject javaWriteCallback, jobject javaCloseCallback, jobject javaFreeCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -2411,16 +3264,264 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeOpenFd(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint fd) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     int errorCode = archive_write_open_fd(archive, fd);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
+        return;
+    }
+    // The 7z writer can stage its data in a seekable output itself, unless a filter changes it.
+    if ((archive_format(archive) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_7ZIP
+            && archive_filter_count(archive) == 1) {
+        addOutputTempFile(getArchiveMemory(archive), fd);
+    }
+}
+
+static la_ssize_t archiveWriteZipAppendCallback(struct archive *archive, void *client_data,
+        const void *buffer, size_t length) {
+    ssize_t bytesWritten = zipAppendWrite(client_data, buffer, length);
+    if (bytesWritten < 0) {
+        archive_set_error(archive, errno, "zipAppendWrite");
+        return -1;
+    }
+    return bytesWritten;
+}
+
+static int archiveCloseZipAppendCallback(struct archive *archive, void *client_data) {
+    if (!zipAppendClose(client_data)) {
+        archive_set_error(archive, errno, "zipAppendClose");
+        return ARCHIVE_FATAL;
+    }
+    return ARCHIVE_OK;
+}
+
+// libarchive ignores the result of the close callback, so it's checked again after closing.
+static int checkZipAppendClosed(struct archive *archive) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (jniData->writeOpenZipAppend && !zipAppendClose(jniData->writeOpenZipAppend)) {
+        archive_set_error(archive, errno, "zipAppendClose");
+        return ARCHIVE_FATAL;
+    }
+    return ARCHIVE_OK;
+}
+
+// Closing clears the error, so a warning from flushing the adaptive entry is restored afterwards.
+static int flushAndCloseArchive(struct archive *archive) {
+    int flushErrorCode = flushAdaptiveZipEntry(archive);
+    if (flushErrorCode < ARCHIVE_WARN) {
+        return flushErrorCode;
+    }
+    int flushErrno = archive_errno(archive);
+    char *flushErrorString = NULL;
+    if (flushErrorCode) {
+        const char *errorString = archive_error_string(archive);
+        flushErrorString = strdup(errorString ? errorString : "flushAdaptiveZipEntry");
+    }
+    int errorCode = archive_write_close(archive);
+    removeOutputTempFile(getArchiveMemory(archive));
+    if (errorCode >= ARCHIVE_WARN) {
+        errorCode = getWorseErrorCode(errorCode, checkZipAppendClosed(archive));
+    }
+    if (flushErrorCode < errorCode) {
+        archive_set_error(archive, flushErrno, "%s",
+                flushErrorString ? flushErrorString : "flushAdaptiveZipEntry");
+        errorCode = flushErrorCode;
+    }
+    free(flushErrorString);
+    return errorCode;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeOpenZipAppendFd(
+        JNIEnv *env, jclass clazz, jlong javaArchive, jint fd) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    if (archive_format(archive) != ARCHIVE_FORMAT_ZIP) {
+        throwArchiveException(env, ARCHIVE_FATAL, "!ARCHIVE_FORMAT_ZIP");
+        return;
+    }
+    // The output is merged with the existing zip as is, so it can't go through any filter. Before
+    // opening, only added filters are counted, and adding the none filter adds nothing.
+    if (archive_filter_count(archive)) {
+        throwArchiveException(env, ARCHIVE_FATAL, "archive_filter_count");
+        return;
+    }
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    // libarchive keeps the client data once opened, so it's never replaced.
+    if (jniData->writeOpenZipAppend) {
+        throwArchiveException(env, ARCHIVE_FATAL, "writeOpenZipAppend");
+        return;
+    }
+    jniData->writeOpenZipAppend = zipAppendOpen(fd);
+    if (!jniData->writeOpenZipAppend) {
+        archive_set_error(archive, errno, "zipAppendOpen");
+        throwArchiveExceptionFromError(env, archive);
+        return;
+    }
+    zipAppendSetAlignment(jniData->writeOpenZipAppend, jniData->zipAlignment,
+            jniData->zipSharedLibraryAlignment);
+    // Entries may be copied in between, so libarchive's output must not be held back in blocks.
+    archive_write_set_bytes_per_block(archive, 0);
+    int errorCode = archive_write_open2(archive, jniData->writeOpenZipAppend, NULL,
+            archiveWriteZipAppendCallback, archiveCloseZipAppendCallback, NULL);
+    if (errorCode) {
+        throwArchiveExceptionFromError(env, archive);
+    }
+}
+
+static bool isValidZipAlignment(jint alignment) {
+    return alignment >= 0 && alignment <= 32 * 1024 && !(alignment & (alignment - 1));
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeZipSetAlignment(
+        JNIEnv *env, jclass clazz, jlong javaArchive, jint alignment,
+        jint sharedLibraryAlignment) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    if (archive_format(archive) != ARCHIVE_FORMAT_ZIP) {
+        throwArchiveException(env, ARCHIVE_FATAL, "!ARCHIVE_FORMAT_ZIP");
+        return;
+    }
+    if (!isValidZipAlignment(alignment) || !isValidZipAlignment(sharedLibraryAlignment)) {
+        throwArchiveException(env, ARCHIVE_FATAL, "isValidZipAlignment");
+        return;
+    }
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    jniData->zipAlignment = (uint32_t) alignment;
+    jniData->zipSharedLibraryAlignment = (uint32_t) sharedLibraryAlignment;
+    if (jniData->writeOpenZipAppend) {
+        zipAppendSetAlignment(jniData->writeOpenZipAppend, jniData->zipAlignment,
+                jniData->zipSharedLibraryAlignment);
+    }
+}
+
+// The array may contain NULL elements, so the length is needed.
+static void freeStringArray(char **stringArray, jsize length) {
+    if (!stringArray) {
+        return;
+    }
+    for (jsize i = 0; i < length; ++i) {
+        free(stringArray[i]);
+    }
+    free(stringArray);
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeZipCopyEntries(
+        JNIEnv *env, jclass clazz, jlong javaArchive, jint sourceFd, jobjectArray javaPathnames,
+        jobjectArray javaNewPathnames) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (!jniData->writeOpenZipAppend) {
+        throwArchiveException(env, ARCHIVE_FATAL, "!writeOpenZipAppend");
+        return;
+    }
+    jsize count = (*env)->GetArrayLength(env, javaPathnames);
+    if (javaNewPathnames && (*env)->GetArrayLength(env, javaNewPathnames) != count) {
+        throwArchiveException(env, ARCHIVE_FATAL, "newPathnames.length");
+        return;
+    }
+    char **pathnames = mallocStringArrayFromBytesArray(env, javaPathnames);
+    char **newPathnames = javaNewPathnames ? mallocStringArrayFromBytesArray(env, javaNewPathnames)
+            : NULL;
+    if (!pathnames || (javaNewPathnames && !newPathnames)) {
+        freeStringArray(pathnames, count);
+        freeStringArray(newPathnames, count);
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocStringArrayFromBytesArray");
+        return;
+    }
+    // The current entry must be complete before copied entries can follow it.
+    int errorCode = flushAdaptiveZipEntry(archive);
+    if (errorCode >= ARCHIVE_WARN) {
+        errorCode = getWorseErrorCode(errorCode, archive_write_finish_entry(archive));
+    }
+    if (errorCode >= ARCHIVE_WARN && !zipAppendCopyEntries(jniData->writeOpenZipAppend, sourceFd,
+            (const char *const *) pathnames, (const char *const *) newPathnames, count)) {
+        archive_set_error(archive, errno, "zipAppendCopyEntries");
+        errorCode = ARCHIVE_FAILED;
+    }
+    freeStringArray(pathnames, count);
+    freeStringArray(newPathnames, count);
+    if (errorCode) {
+        throwArchiveExceptionFromError(env, archive);
+    }
+}
+
+static jclass getArchiveZipRawEntryClass(JNIEnv *env) {
+    static jclass clazz = NULL;
+    if (!clazz) {
+        clazz = findClass(env, "me/zhanghai/android/libarchive/Archive$ZipRawEntry");
+    }
+    return clazz;
+}
+
+static jobject newArchiveZipRawEntry(JNIEnv *env, int fd, const uint8_t *header) {
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    uint64_t dataOffset;
+    if (!zipGetCentralHeaderValue(header, 20, &compressedSize)
+            || !zipGetCentralHeaderValue(header, 24, &uncompressedSize)
+            || !zipGetDataOffset(fd, header, &dataOffset)) {
+        throwArchiveException(env, errno, "zipGetDataOffset");
+        return NULL;
+    }
+    jsize pathnameSize = zipGetU16(header + 28);
+    jbyteArray javaPathname = (*env)->NewByteArray(env, pathnameSize);
+    if (!javaPathname) {
+        return NULL;
+    }
+    (*env)->SetByteArrayRegion(env, javaPathname, 0, pathnameSize,
+            (const jbyte *) header + ZIP_CENTRAL_HEADER_SIZE);
+    jclass clazz = getArchiveZipRawEntryClass(env);
+    static jmethodID constructor = NULL;
+    if (!constructor) {
+        constructor = findMethod(env, clazz, "<init>", "([BIIIJJJ)V");
+    }
+    jobject javaEntry = (*env)->NewObject(env, clazz, constructor, javaPathname,
+            (jint) zipGetU16(header + 10), (jint) zipGetU16(header + 8),
+            (jint) zipGetU32(header + 16), (jlong) compressedSize, (jlong) uncompressedSize,
+            (jlong) dataOffset);
+    (*env)->DeleteLocalRef(env, javaPathname);
+    return javaEntry;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_me_zhanghai_android_libarchive_Archive_readZipRawEntries(
+        JNIEnv *env, jclass clazz, jint fd) {
+    struct ZipCentralDirectory directory;
+    if (!zipReadCentralDirectory(fd, &directory)) {
+        throwArchiveException(env, errno, "zipReadCentralDirectory");
+        return NULL;
+    }
+    jsize count = 0;
+    for (size_t i = 0; i < directory.headersSize;
+            i += zipGetCentralHeaderSize(directory.headers + i)) {
+        ++count;
+    }
+    jobjectArray javaEntries = (*env)->NewObjectArray(env, count,
+            getArchiveZipRawEntryClass(env), NULL);
+    for (size_t i = 0, index = 0; javaEntries && i < directory.headersSize; ++index) {
+        const uint8_t *header = directory.headers + i;
+        jobject javaEntry = newArchiveZipRawEntry(env, fd, header);
+        if (!javaEntry) {
+            javaEntries = NULL;
+            break;
+        }
+        (*env)->SetObjectArrayElement(env, javaEntries, (jsize) index, javaEntry);
+        (*env)->DeleteLocalRef(env, javaEntry);
+        i += zipGetCentralHeaderSize(header);
     }
+    zipFreeCentralDirectory(&directory);
+    return javaEntries;
 }
 
 JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeOpenFileName(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaFileName) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *fileName = mallocStringFromBytes(env, javaFileName);
     if (javaFileName && !fileName) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2437,6 +3538,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeOpenMemory(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaBuffer) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct ArchiveJniData *jniData = archive_get_user_data(archive);
     if (jniData->openMemoryArray) {
         (*env)->ReleaseByteArrayElements(env, jniData->openMemoryJavaArray,
@@ -2478,6 +3580,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeOpenMemoryUnsafe(
         JNIEnv *env, jclass clazz, jlong javaArchive, jlong javaBuffer, jlong bufferSize) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct ArchiveJniData *jniData = archive_get_user_data(archive);
     jniData->writeOpenMemoryUsed = 0;
     void *buffer = (void *) javaBuffer;
@@ -2492,16 +3595,193 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeOpenMemoryGetUsed(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct ArchiveJniData *jniData = archive_get_user_data(archive);
     return jniData->writeOpenMemoryUsed;
 }
 
+// Fixed-size segments, so that growing never copies what's already written.
+#define GROWABLE_MEMORY_SEGMENT_SIZE (256 * 1024)
+
+struct GrowableMemory {
+    uint8_t **segments;
+    size_t segmentCount;
+    size_t segmentCapacity;
+    size_t used;
+};
+
+static void freeGrowableMemory(struct GrowableMemory *memory) {
+    if (!memory) {
+        return;
+    }
+    for (size_t i = 0; i < memory->segmentCount; ++i) {
+        free(memory->segments[i]);
+    }
+    free(memory->segments);
+    free(memory);
+}
+
+static la_ssize_t archiveWriteGrowableMemoryCallback(struct archive *archive, void *client_data,
+        const void *buffer, size_t length) {
+    struct GrowableMemory *memory = client_data;
+    const uint8_t *bytes = buffer;
+    size_t remaining = length;
+    while (remaining) {
+        if (memory->used == memory->segmentCount * GROWABLE_MEMORY_SEGMENT_SIZE) {
+            if (!growArray((void **) &memory->segments, &memory->segmentCapacity,
+                    memory->segmentCount, sizeof(*memory->segments))) {
+                archive_set_error(archive, ENOMEM, "growArray");
+                return -1;
+            }
+            uint8_t *segment = malloc(GROWABLE_MEMORY_SEGMENT_SIZE);
+            if (!segment) {
+                archive_set_error(archive, ENOMEM, "malloc");
+                return -1;
+            }
+            memory->segments[memory->segmentCount++] = segment;
+        }
+        size_t segmentOffset = memory->used % GROWABLE_MEMORY_SEGMENT_SIZE;
+        size_t copySize = GROWABLE_MEMORY_SEGMENT_SIZE - segmentOffset;
+        if (copySize > remaining) {
+            copySize = remaining;
+        }
+        memcpy(memory->segments[memory->used / GROWABLE_MEMORY_SEGMENT_SIZE] + segmentOffset,
+                bytes, copySize);
+        memory->used += copySize;
+        bytes += copySize;
+        remaining -= copySize;
+    }
+    return (la_ssize_t) length;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeOpenGrowableMemory(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    // libarchive keeps the client data once opened, so it's never replaced.
+    if (!jniData->writeOpenGrowableMemory) {
+        jniData->writeOpenGrowableMemory = calloc(1, sizeof(*jniData->writeOpenGrowableMemory));
+        if (!jniData->writeOpenGrowableMemory) {
+            throwArchiveException(env, ARCHIVE_FATAL, "calloc");
+            return;
+        }
+    }
+    // Don't pad the last block, as in archive_write_open_memory().
+    if (archive_write_get_bytes_in_last_block(archive) == -1) {
+        archive_write_set_bytes_in_last_block(archive, 1);
+    }
+    int errorCode = archive_write_open2(archive, jniData->writeOpenGrowableMemory, NULL,
+            archiveWriteGrowableMemoryCallback, NULL, NULL);
+    if (errorCode) {
+        throwArchiveExceptionFromError(env, archive);
+    }
+}
+
+static struct GrowableMemory *getWriteOpenGrowableMemory(JNIEnv *env, struct archive *archive) {
+    struct ArchiveJniData *jniData = archive_get_user_data(archive);
+    if (!jniData->writeOpenGrowableMemory) {
+        throwArchiveException(env, ARCHIVE_FATAL, "!writeOpenGrowableMemory");
+    }
+    return jniData->writeOpenGrowableMemory;
+}
+
+JNIEXPORT jlong JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeOpenGrowableMemoryGetUsed(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    struct GrowableMemory *memory = getWriteOpenGrowableMemory(env, archive);
+    if (!memory) {
+        return 0;
+    }
+    return (jlong) memory->used;
+}
+
+static jobject newReadOnlyByteBuffer(JNIEnv *env, void *buffer, size_t length) {
+    jobject javaBuffer = (*env)->NewDirectByteBuffer(env, buffer, (jlong) length);
+    if (!javaBuffer) {
+        return NULL;
+    }
+    static jmethodID method = NULL;
+    if (!method) {
+        method = findMethod(env, getByteBufferClass(env), "asReadOnlyBuffer",
+                "()Ljava/nio/ByteBuffer;");
+    }
+    jobject javaReadOnlyBuffer = (*env)->CallObjectMethod(env, javaBuffer, method);
+    (*env)->DeleteLocalRef(env, javaBuffer);
+    return javaReadOnlyBuffer;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeOpenGrowableMemoryGetBuffers(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    struct GrowableMemory *memory = getWriteOpenGrowableMemory(env, archive);
+    if (!memory) {
+        return NULL;
+    }
+    size_t bufferCount = (memory->used + GROWABLE_MEMORY_SEGMENT_SIZE - 1)
+            / GROWABLE_MEMORY_SEGMENT_SIZE;
+    jobjectArray javaBuffers = (*env)->NewObjectArray(env, (jsize) bufferCount,
+            getByteBufferClass(env), NULL);
+    if (!javaBuffers) {
+        throwArchiveException(env, ARCHIVE_FATAL, "NewObjectArray");
+        return NULL;
+    }
+    for (size_t i = 0; i < bufferCount; ++i) {
+        size_t length = memory->used - i * GROWABLE_MEMORY_SEGMENT_SIZE;
+        if (length > GROWABLE_MEMORY_SEGMENT_SIZE) {
+            length = GROWABLE_MEMORY_SEGMENT_SIZE;
+        }
+        jobject javaBuffer = newReadOnlyByteBuffer(env, memory->segments[i], length);
+        if (!javaBuffer) {
+            (*env)->ExceptionClear(env);
+            throwArchiveException(env, ARCHIVE_FATAL, "newReadOnlyByteBuffer");
+            return NULL;
+        }
+        (*env)->SetObjectArrayElement(env, javaBuffers, (jsize) i, javaBuffer);
+        (*env)->DeleteLocalRef(env, javaBuffer);
+    }
+    return javaBuffers;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_me_zhanghai_android_libarchive_Archive_writeOpenGrowableMemoryToByteArray(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    struct GrowableMemory *memory = getWriteOpenGrowableMemory(env, archive);
+    if (!memory) {
+        return NULL;
+    }
+    if (memory->used > INT32_MAX) {
+        throwArchiveException(env, ARCHIVE_FATAL, "used > INT32_MAX");
+        return NULL;
+    }
+    jbyteArray javaArray = (*env)->NewByteArray(env, (jsize) memory->used);
+    if (!javaArray) {
+        throwArchiveException(env, ARCHIVE_FATAL, "NewByteArray");
+        return NULL;
+    }
+    for (size_t offset = 0, i = 0; offset < memory->used; offset += GROWABLE_MEMORY_SEGMENT_SIZE,
+            ++i) {
+        size_t length = memory->used - offset;
+        if (length > GROWABLE_MEMORY_SEGMENT_SIZE) {
+            length = GROWABLE_MEMORY_SEGMENT_SIZE;
+        }
+        (*env)->SetByteArrayRegion(env, javaArray, (jsize) offset, (jsize) length,
+                (const jbyte *) memory->segments[i]);
+    }
+    return javaArray;
+}
+
 JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeHeader(
         JNIEnv *env, jclass clazz, jlong javaArchive, jlong javaEntry) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
-    int errorCode = archive_write_header(archive, entry);
+    int errorCode = writeAdaptiveZipHeader(archive, entry);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
@@ -2511,6 +3791,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeData(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject javaBuffer) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jint position = 0;
     jbyteArray javaArray = NULL;
     jbyte *array = NULL;
@@ -2522,7 +3803,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeData(
         throwArchiveException(env, ARCHIVE_FATAL, errorMessage);
         return;
     }
-    int bytesWritten = archive_write_data(archive, buffer, bufferSize);
+    int bytesWritten = (int) writeAdaptiveZipData(archive, buffer, bufferSize);
     if (array) {
         (*env)->ReleaseByteArrayElements(env, javaArray, array, JNI_ABORT);
     }
@@ -2541,7 +3822,11 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeFinishEntry(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
-    int errorCode = archive_write_finish_entry(archive);
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    int errorCode = flushAdaptiveZipEntry(archive);
+    if (errorCode >= ARCHIVE_WARN) {
+        errorCode = getWorseErrorCode(errorCode, archive_write_finish_entry(archive));
+    }
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
@@ -2551,7 +3836,8 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeClose(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
-    int errorCode = archive_write_close(archive);
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    int errorCode = flushAndCloseArchive(archive);
     closeArchiveJniData(env, archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2562,6 +3848,8 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeFail(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    discardAdaptiveZipEntry(archive);
     int errorCode = archive_write_fail(archive);
     if (errorCode) {
         throwArchiveExceptionFromError(env, archive);
@@ -2573,6 +3861,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeSetFormatOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2602,6 +3891,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeSetFilterOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2631,6 +3921,7 @@ Java_me_zhanghai_android_libarchive_Archive_writeSetOption(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaModule, jbyteArray javaOption,
         jbyteArray javaValue) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *module = mallocStringFromBytes(env, javaModule);
     if (javaModule && !module) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2659,6 +3950,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetOptions(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaOptions) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *options = mallocStringFromBytes(env, javaOptions);
     if (javaOptions && !options) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2675,6 +3967,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetPassphrase(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaPassphrase) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *passphrase = mallocStringFromBytes(env, javaPassphrase);
     if (javaPassphrase && !passphrase) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2691,6 +3984,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_writeSetPassphraseCallback(
         JNIEnv *env, jclass clazz, jlong javaArchive, jobject clientData, jobject javaCallback) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     jobject clientDataRef = (*env)->NewGlobalRef(env, clientData);
     if (clientData && !clientDataRef) {
         throwArchiveException(env, ARCHIVE_FATAL, "NewGlobalRef");
@@ -2756,6 +4050,10 @@ static void freeArchiveJniData(JNIEnv* env, struct archive *archive) {
     (*env)->DeleteGlobalRef(env, jniData->passphraseClientData);
     (*env)->DeleteGlobalRef(env, jniData->passphraseCallback);
     free(jniData->passphrase);
+    freeArchiveSearch(jniData->search);
+    freeGrowableMemory(jniData->writeOpenGrowableMemory);
+    zipAppendFree(jniData->writeOpenZipAppend);
+    freeAdaptiveZip(jniData->adaptiveZip);
     free(jniData);
 }
 
@@ -2763,15 +4061,19 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_free(
         JNIEnv* env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    struct ArchiveMemory *memory = getArchiveMemory(archive);
+    ARCHIVE_MEMORY_SCOPE(memory);
     // archive_write_close() is the same as archive_read_close(), and we must call it before
     // freeArchiveJniData() because it may need to finish writing data.
-    int closeErrorCode = archive_write_close(archive);
-    if (closeErrorCode) {
+    int closeErrorCode = flushAndCloseArchive(archive);
+    if (closeErrorCode < ARCHIVE_WARN) {
         // Prevent archive_free() from trying to close again.
         archive_write_fail(archive);
     }
     freeArchiveJniData(env, archive);
     int freeErrorCode = archive_free(archive);
+    removeOutputTempFile(memory);
+    archiveMemoryFree(memory);
     if (closeErrorCode) {
         throwArchiveExceptionFromError(env, archive);
     }
@@ -2780,10 +4082,42 @@ Java_me_zhanghai_android_libarchive_Archive_free(
     }
 }
 
+static jclass getArchiveMemoryStatsClass(JNIEnv *env) {
+    static jclass clazz = NULL;
+    if (!clazz) {
+        clazz = findClass(env, "me/zhanghai/android/libarchive/Archive$MemoryStats");
+    }
+    return clazz;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_Archive_setMemoryBudget(
+        JNIEnv *env, jclass clazz, jlong javaArchive, jlong budget) {
+    struct archive *archive = (struct archive *) javaArchive;
+    archiveMemorySetBudget(getArchiveMemory(archive), budget > 0 ? (size_t) budget : 0);
+}
+
+JNIEXPORT jobject JNICALL
+Java_me_zhanghai_android_libarchive_Archive_memoryStats(
+        JNIEnv *env, jclass clazz, jlong javaArchive) {
+    struct archive *archive = (struct archive *) javaArchive;
+    size_t currentSize = 0;
+    size_t peakSize = 0;
+    archiveMemoryGetStats(getArchiveMemory(archive), &currentSize, &peakSize);
+    jclass memoryStatsClass = getArchiveMemoryStatsClass(env);
+    static jmethodID constructor = NULL;
+    if (!constructor) {
+        constructor = findMethod(env, memoryStatsClass, "<init>", "(JJ)V");
+    }
+    return (*env)->NewObject(env, memoryStatsClass, constructor, (jlong) currentSize,
+            (jlong) peakSize);
+}
+
 JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_filterCount(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_filter_count(archive);
 }
 
@@ -2791,6 +4125,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_Archive_filterBytes(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint index) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_filter_bytes(archive, index);
 }
 
@@ -2798,6 +4133,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_filterCode(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint index) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_filter_code(archive, index);
 }
 
@@ -2805,6 +4141,7 @@ JNIEXPORT jbyteArray JNICALL
 Java_me_zhanghai_android_libarchive_Archive_filterName(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint index) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const char *filterName = archive_filter_name(archive, index);
     return newBytesFromString(env, filterName);
 }
@@ -2813,6 +4150,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_errno(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_errno(archive);
 }
 
@@ -2820,6 +4158,7 @@ JNIEXPORT jbyteArray JNICALL
 Java_me_zhanghai_android_libarchive_Archive_errorString(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const char *string = archive_error_string(archive);
     return newBytesFromString(env, string);
 }
@@ -2828,6 +4167,7 @@ JNIEXPORT jbyteArray JNICALL
 Java_me_zhanghai_android_libarchive_Archive_formatName(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const char *formatName = archive_format_name(archive);
     return newBytesFromString(env, formatName);
 }
@@ -2836,6 +4176,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_format(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_format(archive);
 }
 
@@ -2843,6 +4184,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_clearError(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     archive_clear_error(archive);
 }
 
@@ -2850,6 +4192,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_setError(
         JNIEnv *env, jclass clazz, jlong javaArchive, jint number, jbyteArray javaString) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     if (javaString) {
         char *string = mallocStringFromBytes(env, javaString);
         archive_set_error(archive, number, "%s", string);
@@ -2871,6 +4214,7 @@ JNIEXPORT jint JNICALL
 Java_me_zhanghai_android_libarchive_Archive_fileCount(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return archive_file_count(archive);
 }
 
@@ -2878,6 +4222,7 @@ JNIEXPORT jbyteArray JNICALL
 Java_me_zhanghai_android_libarchive_Archive_charset(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     const char *charset = archive_charset(archive);
     return newBytesFromString(env, charset);
 }
@@ -2886,6 +4231,7 @@ JNIEXPORT void JNICALL
 Java_me_zhanghai_android_libarchive_Archive_setCharset(
         JNIEnv *env, jclass clazz, jlong javaArchive, jbyteArray javaCharset) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     char *charset = mallocStringFromBytes(env, javaCharset);
     if (javaCharset && !charset) {
         throwArchiveException(env, ARCHIVE_FATAL, "mallocStringFromBytes");
@@ -2929,6 +4275,7 @@ JNIEXPORT jlong JNICALL
 Java_me_zhanghai_android_libarchive_ArchiveEntry_new2(
         JNIEnv *env, jclass clazz, jlong javaArchive) {
     struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
     return (jlong) archive_entry_new2(archive);
 }
 
@@ -3092,7 +4439,7 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_gnameUtf8(
         JNIEnv *env, jclass clazz, jlong javaEntry) {
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     const char *gnameUtf8 = archive_entry_gname_utf8(entry);
-    return (*env)->NewStringUTF(env, gnameUtf8);
+    return newStringFromUtf8(env, gnameUtf8);
 }
 
 JNIEXPORT jbyteArray JNICALL
@@ -3108,7 +4455,7 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_hardlinkUtf8(
         JNIEnv *env, jclass clazz, jlong javaEntry) {
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     const char *hardlinkUtf8 = archive_entry_hardlink_utf8(entry);
-    return (*env)->NewStringUTF(env, hardlinkUtf8);
+    return newStringFromUtf8(env, hardlinkUtf8);
 }
 
 JNIEXPORT jboolean JNICALL
@@ -3180,7 +4527,7 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_pathnameUtf8(
         JNIEnv *env, jclass clazz, jlong javaEntry) {
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     const char *pathnameUtf8 = archive_entry_pathname_utf8(entry);
-    return (*env)->NewStringUTF(env, pathnameUtf8);
+    return newStringFromUtf8(env, pathnameUtf8);
 }
 
 JNIEXPORT jint JNICALL
@@ -3268,7 +4615,7 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_symlinkUtf8(
         JNIEnv *env, jclass clazz, jlong javaEntry) {
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     const char *symlinkUtf8 = archive_entry_symlink_utf8(entry);
-    return (*env)->NewStringUTF(env, symlinkUtf8);
+    return newStringFromUtf8(env, symlinkUtf8);
 }
 
 JNIEXPORT jint JNICALL
@@ -3305,7 +4652,7 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_unameUtf8(
         JNIEnv *env, jclass clazz, jlong javaEntry) {
     struct archive_entry *entry = (struct archive_entry *) javaEntry;
     const char *unameUtf8 = archive_entry_uname_utf8(entry);
-    return (*env)->NewStringUTF(env, unameUtf8);
+    return newStringFromUtf8(env, unameUtf8);
 }
 
 JNIEXPORT jboolean JNICALL
@@ -3752,3 +5099,199 @@ Java_me_zhanghai_android_libarchive_ArchiveEntry_digest(
     }
     return javaDigest;
 }
+
+// The archive key followed by the pathname, as stored by the entry cache.
+static uint8_t *mallocEntryCacheKey(JNIEnv *env, jbyteArray javaArchiveKey,
+        jbyteArray javaPathname, size_t *outArchiveKeySize, size_t *outPathnameSize) {
+    jsize archiveKeySize = (*env)->GetArrayLength(env, javaArchiveKey);
+    jsize pathnameSize = (*env)->GetArrayLength(env, javaPathname);
+    uint8_t *key = malloc((size_t) archiveKeySize + (size_t) pathnameSize + 1);
+    if (!key) {
+        return NULL;
+    }
+    (*env)->GetByteArrayRegion(env, javaArchiveKey, 0, archiveKeySize, (jbyte *) key);
+    (*env)->GetByteArrayRegion(env, javaPathname, 0, pathnameSize,
+            (jbyte *) key + archiveKeySize);
+    *outArchiveKeySize = (size_t) archiveKeySize;
+    *outPathnameSize = (size_t) pathnameSize;
+    return key;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_ArchiveEntryCache_setLimits(
+        JNIEnv *env, jclass clazz, jlong memoryLimit, jlong compressedMemoryLimit) {
+    entryCacheSetLimits(memoryLimit > 0 ? (size_t) memoryLimit : 0,
+            compressedMemoryLimit > 0 ? (size_t) compressedMemoryLimit : 0);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_me_zhanghai_android_libarchive_ArchiveEntryCache_put(
+        JNIEnv *env, jclass clazz, jbyteArray javaArchiveKey, jbyteArray javaPathname,
+        jobject javaContent) {
+    size_t archiveKeySize = 0;
+    size_t pathnameSize = 0;
+    uint8_t *key = mallocEntryCacheKey(env, javaArchiveKey, javaPathname, &archiveKeySize,
+            &pathnameSize);
+    if (!key) {
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocEntryCacheKey");
+        return false;
+    }
+    jint position = 0;
+    jbyteArray javaArray = NULL;
+    jbyte *array = NULL;
+    void *content = NULL;
+    int32_t contentSize = 0;
+    const char *errorMessage = getByteBufferBuffer(env, javaContent, false, &position, &javaArray,
+            &array, &content, &contentSize);
+    if (errorMessage) {
+        free(key);
+        throwArchiveException(env, ARCHIVE_FATAL, errorMessage);
+        return false;
+    }
+    bool isPut = entryCachePut(key, archiveKeySize, key + archiveKeySize, pathnameSize, content,
+            (size_t) contentSize);
+    if (array) {
+        (*env)->ReleaseByteArrayElements(env, javaArray, array, JNI_ABORT);
+    }
+    free(key);
+    return isPut;
+}
+
+// Prefetching runs this on a background thread for the entries the app expects to read next.
+JNIEXPORT jboolean JNICALL
+Java_me_zhanghai_android_libarchive_ArchiveEntryCache_putData(
+        JNIEnv *env, jclass clazz, jbyteArray javaArchiveKey, jbyteArray javaPathname,
+        jlong javaArchive, jlong maxSize) {
+    struct archive *archive = (struct archive *) javaArchive;
+    ARCHIVE_MEMORY_SCOPE(getArchiveMemory(archive));
+    size_t archiveKeySize = 0;
+    size_t pathnameSize = 0;
+    uint8_t *key = mallocEntryCacheKey(env, javaArchiveKey, javaPathname, &archiveKeySize,
+            &pathnameSize);
+    if (!key) {
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocEntryCacheKey");
+        return false;
+    }
+    // Content beyond the cache's limit would only be read to be dropped, so stop reading there.
+    size_t maxContentSize = entryCacheGetMemoryLimit();
+    if (!maxContentSize) {
+        free(key);
+        return false;
+    }
+    if (maxSize >= 0 && (uint64_t) maxSize < maxContentSize) {
+        maxContentSize = (size_t) maxSize;
+    }
+    // Leave room for a byte past the limit, so that reaching it can be told apart from the end.
+    size_t maxContentCapacity = maxContentSize < SIZE_MAX ? maxContentSize + 1 : SIZE_MAX;
+    uint8_t *content = NULL;
+    size_t contentSize = 0;
+    size_t contentCapacity = 0;
+    while (true) {
+        if (contentSize == contentCapacity) {
+            size_t newContentCapacity = contentCapacity ? contentCapacity * 2 : 64 * 1024;
+            if (newContentCapacity > maxContentCapacity || newContentCapacity < contentCapacity) {
+                newContentCapacity = maxContentCapacity;
+            }
+            uint8_t *newContent;
+            {
+                // The content is handed to the cache, so keep it off the archive's memory.
+                ARCHIVE_MEMORY_SCOPE(NULL);
+                newContent = realloc(content, newContentCapacity);
+            }
+            if (!newContent) {
+                free(content);
+                free(key);
+                throwArchiveException(env, ARCHIVE_FATAL, "realloc");
+                return false;
+            }
+            content = newContent;
+            contentCapacity = newContentCapacity;
+        }
+        la_ssize_t bytesRead = archive_read_data(archive, content + contentSize,
+                contentCapacity - contentSize);
+        if (bytesRead < 0) {
+            free(content);
+            free(key);
+            throwArchiveExceptionFromError(env, archive);
+            return false;
+        }
+        if (!bytesRead) {
+            break;
+        }
+        contentSize += (size_t) bytesRead;
+        if (contentSize > maxContentSize) {
+            free(content);
+            free(key);
+            return false;
+        }
+    }
+    bool isPut;
+    {
+        // Items and their compressed copies belong to the cache, not the archive.
+        ARCHIVE_MEMORY_SCOPE(NULL);
+        isPut = entryCachePutOwned(key, archiveKeySize, key + archiveKeySize, pathnameSize,
+                content, contentSize);
+    }
+    free(key);
+    return isPut;
+}
+
+JNIEXPORT jobject JNICALL
+Java_me_zhanghai_android_libarchive_ArchiveEntryCache_get(
+        JNIEnv *env, jclass clazz, jbyteArray javaArchiveKey, jbyteArray javaPathname) {
+    size_t archiveKeySize = 0;
+    size_t pathnameSize = 0;
+    uint8_t *key = mallocEntryCacheKey(env, javaArchiveKey, javaPathname, &archiveKeySize,
+            &pathnameSize);
+    if (!key) {
+        throwArchiveException(env, ARCHIVE_FATAL, "mallocEntryCacheKey");
+        return NULL;
+    }
+    struct EntryCacheItem *item = entryCacheAcquire(key, archiveKeySize, key + archiveKeySize,
+            pathnameSize);
+    free(key);
+    if (!item) {
+        return NULL;
+    }
+    size_t contentSize = entryCacheItemGetContentSize(item);
+    if (contentSize > INT32_MAX) {
+        entryCacheRelease(item);
+        return NULL;
+    }
+    // The cache owns its memory, so the content is copied into a buffer owned by the caller.
+    jclass byteBufferClass = getByteBufferClass(env);
+    static jmethodID allocateDirectMethod = NULL;
+    if (!allocateDirectMethod) {
+        allocateDirectMethod = findStaticMethod(env, byteBufferClass, "allocateDirect",
+                "(I)Ljava/nio/ByteBuffer;");
+    }
+    jobject javaBuffer = (*env)->CallStaticObjectMethod(env, byteBufferClass,
+            allocateDirectMethod, (jint) contentSize);
+    void *buffer = javaBuffer ? (*env)->GetDirectBufferAddress(env, javaBuffer) : NULL;
+    if (!buffer) {
+        entryCacheRelease(item);
+        (*env)->ExceptionClear(env);
+        throwArchiveException(env, ARCHIVE_FATAL, "ByteBuffer.allocateDirect");
+        return NULL;
+    }
+    memcpy(buffer, entryCacheItemGetContent(item), contentSize);
+    entryCacheRelease(item);
+    return javaBuffer;
+}
+
+JNIEXPORT void JNICALL
+Java_me_zhanghai_android_libarchive_ArchiveEntryCache_invalidate(
+        JNIEnv *env, jclass clazz, jbyteArray javaArchiveKey) {
+    if (!javaArchiveKey) {
+        entryCacheInvalidate(NULL, 0);
+        return;
+    }
+    jsize archiveKeySize = (*env)->GetArrayLength(env, javaArchiveKey);
+    jbyte *archiveKey = (*env)->GetByteArrayElements(env, javaArchiveKey, NULL);
+    if (!archiveKey) {
+        throwArchiveException(env, ARCHIVE_FATAL, "GetByteArrayElements");
+        return;
+    }
+    entryCacheInvalidate((const uint8_t *) archiveKey, (size_t) archiveKeySize);
+    (*env)->ReleaseByteArrayElements(env, javaArchiveKey, archiveKey, JNI_ABORT);
+}
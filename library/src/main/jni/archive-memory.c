@@ -0,0 +1,518 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Allocator hooks that account large native allocations to the archive they are made for, hooked
+// in with the linker's --wrap for everything in libarchive-jni, including libarchive and the codec
+// libraries.
+//
+// Allocations of at least LARGE_ALLOCATION_SIZE, e.g. liblzma dictionaries, PPMd models and zstd
+// windows, are recorded in a table with the memory that was entered on the allocating thread, and
+// smaller ones go straight to the system allocator. There are no headers on allocations, because
+// some memory is allocated inside libc, e.g. by strdup(), and freed by us. Allocations of at least
+// HUGE_ALLOCATION_SIZE are mapped directly and advised for transparent huge pages when the kernel
+// supports them. The last mapping freed on a memory is kept until the next huge allocation on it,
+// which reuses it if it's large enough, because the PPMd model is allocated and freed again for
+// every 7z folder, RAR solid stream or zip entry, and faulting in a fresh mapping of up to hundreds
+// of megabytes each time costs more than the decompression for small entries. The kept mapping
+// still counts in the current size of the memory, and is released when an allocation would
+// otherwise exceed the budget.
+//
+// Small blocks freed while a memory is entered are kept on its free lists by size class and handed
+// out again to the next allocations on it, because libarchive clears and rebuilds the strings of
+// its entry for every header, which otherwise costs a few allocator round trips per entry.
+
+#include "archive-memory.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define LARGE_ALLOCATION_SIZE (64 * 1024)
+#define HUGE_ALLOCATION_SIZE (2 * 1024 * 1024)
+#define LARGE_ALLOCATION_BUCKET_COUNT 256
+// Mapped allocations are aligned to at least this, whatever the page size is.
+#define MIN_PAGE_SIZE 4096
+#define SMALL_BLOCK_CLASS_SIZE 16
+#define SMALL_BLOCK_CLASS_COUNT 16
+// Enough for the strings of a few entries, and bounds what an idle archive holds on to.
+#define SMALL_BLOCK_CLASS_CAPACITY 32
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+struct SmallBlock {
+    struct SmallBlock *next;
+};
+
+struct ArchiveMemory {
+    size_t budget;
+    bool isBudgetExceeded;
+    size_t currentSize;
+    size_t peakSize;
+    // Only touched on the thread that has entered the memory. Blocks in class i have a usable size
+    // of at least (i + 1) * SMALL_BLOCK_CLASS_SIZE.
+    struct SmallBlock *smallBlocks[SMALL_BLOCK_CLASS_COUNT];
+    size_t smallBlockCounts[SMALL_BLOCK_CLASS_COUNT];
+    // A freed mapped allocation kept for reuse, which isn't in the table but counts in the current
+    // size.
+    struct LargeAllocation *retainedAllocation;
+};
+
+struct LargeAllocation {
+    void *pointer;
+    size_t size;
+    // The length of the mapping for mapped allocations, or 0.
+    size_t mappedSize;
+    struct ArchiveMemory *memory;
+    struct LargeAllocation *next;
+};
+
+static pthread_mutex_t gLargeAllocationsMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct LargeAllocation *gLargeAllocations[LARGE_ALLOCATION_BUCKET_COUNT];
+
+static pthread_once_t gCurrentMemoryKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gCurrentMemoryKey;
+
+static void initCurrentMemoryKey(void) {
+    pthread_key_create(&gCurrentMemoryKey, NULL);
+}
+
+static struct ArchiveMemory *getCurrentMemory() {
+    pthread_once(&gCurrentMemoryKeyOnce, initCurrentMemoryKey);
+    return pthread_getspecific(gCurrentMemoryKey);
+}
+
+struct ArchiveMemory *archiveMemoryNew(void) {
+    return __real_calloc(1, sizeof(struct ArchiveMemory));
+}
+
+static void releaseLargeAllocation(struct LargeAllocation *allocation);
+
+static bool exceedsBudget(const struct ArchiveMemory *memory, size_t size);
+
+static struct LargeAllocation *takeRetainedAllocation(struct ArchiveMemory *memory);
+
+void archiveMemoryFree(struct ArchiveMemory *memory) {
+    if (!memory) {
+        return;
+    }
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    for (size_t i = 0; i < LARGE_ALLOCATION_BUCKET_COUNT; ++i) {
+        for (struct LargeAllocation *allocation = gLargeAllocations[i]; allocation;
+                allocation = allocation->next) {
+            if (allocation->memory == memory) {
+                allocation->memory = NULL;
+            }
+        }
+    }
+    struct LargeAllocation *retainedAllocation = memory->retainedAllocation;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    if (retainedAllocation) {
+        releaseLargeAllocation(retainedAllocation);
+    }
+    for (size_t i = 0; i < SMALL_BLOCK_CLASS_COUNT; ++i) {
+        struct SmallBlock *block = memory->smallBlocks[i];
+        while (block) {
+            struct SmallBlock *next = block->next;
+            __real_free(block);
+            block = next;
+        }
+    }
+    if (getCurrentMemory() == memory) {
+        pthread_setspecific(gCurrentMemoryKey, NULL);
+    }
+    __real_free(memory);
+}
+
+void archiveMemorySetBudget(struct ArchiveMemory *memory, size_t budget) {
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    memory->budget = budget;
+    struct LargeAllocation *retainedAllocation = exceedsBudget(memory, 0)
+            ? takeRetainedAllocation(memory) : NULL;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    if (retainedAllocation) {
+        releaseLargeAllocation(retainedAllocation);
+    }
+}
+
+void archiveMemoryGetStats(struct ArchiveMemory *memory, size_t *outCurrentSize,
+                           size_t *outPeakSize) {
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    *outCurrentSize = memory->currentSize;
+    *outPeakSize = memory->peakSize;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+}
+
+bool archiveMemoryTakeBudgetExceeded(void) {
+    struct ArchiveMemory *memory = getCurrentMemory();
+    if (!memory) {
+        return false;
+    }
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    bool isBudgetExceeded = memory->isBudgetExceeded;
+    memory->isBudgetExceeded = false;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    return isBudgetExceeded;
+}
+
+struct ArchiveMemory *archiveMemoryEnter(struct ArchiveMemory *memory) {
+    struct ArchiveMemory *previousMemory = getCurrentMemory();
+    if (memory) {
+        pthread_mutex_lock(&gLargeAllocationsMutex);
+        memory->isBudgetExceeded = false;
+        pthread_mutex_unlock(&gLargeAllocationsMutex);
+    }
+    pthread_setspecific(gCurrentMemoryKey, memory);
+    return previousMemory;
+}
+
+void archiveMemoryLeave(struct ArchiveMemory **previousMemory) {
+    pthread_setspecific(gCurrentMemoryKey, *previousMemory);
+}
+
+struct ArchiveMemory *archiveMemoryGetCurrent(void) {
+    return getCurrentMemory();
+}
+
+static size_t getLargeAllocationBucket(const void *pointer) {
+    uintptr_t address = (uintptr_t) pointer;
+    return ((address >> 12) ^ (address >> 20)) % LARGE_ALLOCATION_BUCKET_COUNT;
+}
+
+// Mapped allocations are page aligned, and malloc_usable_size() can't be called on them.
+static bool mayBeLargeAllocation(void *pointer) {
+    return !((uintptr_t) pointer & (MIN_PAGE_SIZE - 1))
+            || malloc_usable_size(pointer) >= LARGE_ALLOCATION_SIZE;
+}
+
+static void *mapHugeAllocation(size_t size, size_t *outMappedSize) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mappedSize = (size + pageSize - 1) & ~(pageSize - 1);
+    void *pointer = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0);
+    if (pointer == MAP_FAILED) {
+        return NULL;
+    }
+#if defined(MADV_HUGEPAGE)
+    // Fails harmlessly when the kernel is built without transparent huge pages.
+    madvise(pointer, mappedSize, MADV_HUGEPAGE);
+#endif
+    *outMappedSize = mappedSize;
+    return pointer;
+}
+
+static void releaseLargeAllocation(struct LargeAllocation *allocation) {
+    if (allocation->mappedSize) {
+        munmap(allocation->pointer, allocation->mappedSize);
+    } else {
+        __real_free(allocation->pointer);
+    }
+    __real_free(allocation);
+}
+
+// Must be called with the lock.
+static bool exceedsBudget(const struct ArchiveMemory *memory, size_t size) {
+    // The budget may have been lowered below the current size.
+    return memory->budget && (memory->currentSize > memory->budget
+            || size > memory->budget - memory->currentSize);
+}
+
+// Must be called with the lock.
+static struct LargeAllocation *takeRetainedAllocation(struct ArchiveMemory *memory) {
+    struct LargeAllocation *retainedAllocation = memory->retainedAllocation;
+    if (retainedAllocation) {
+        memory->retainedAllocation = NULL;
+        memory->currentSize -= retainedAllocation->size;
+    }
+    return retainedAllocation;
+}
+
+static void *allocateLarge(size_t size, bool zero) {
+    struct LargeAllocation *allocation = __real_malloc(sizeof(*allocation));
+    if (!allocation) {
+        return NULL;
+    }
+    struct ArchiveMemory *memory = getCurrentMemory();
+    allocation->size = size;
+    allocation->mappedSize = 0;
+    allocation->memory = memory;
+    // Either reused for a huge allocation, or released to make room for this one.
+    struct LargeAllocation *retainedAllocation = NULL;
+    if (memory) {
+        pthread_mutex_lock(&gLargeAllocationsMutex);
+        if (size >= HUGE_ALLOCATION_SIZE) {
+            retainedAllocation = takeRetainedAllocation(memory);
+        }
+        bool isOverBudget = exceedsBudget(memory, size);
+        if (isOverBudget && memory->retainedAllocation) {
+            retainedAllocation = takeRetainedAllocation(memory);
+            isOverBudget = exceedsBudget(memory, size);
+        }
+        if (!isOverBudget) {
+            memory->currentSize += size;
+            if (memory->peakSize < memory->currentSize) {
+                memory->peakSize = memory->currentSize;
+            }
+        } else {
+            memory->isBudgetExceeded = true;
+        }
+        pthread_mutex_unlock(&gLargeAllocationsMutex);
+        if (isOverBudget) {
+            if (retainedAllocation) {
+                releaseLargeAllocation(retainedAllocation);
+            }
+            __real_free(allocation);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    void *pointer = NULL;
+    if (size >= HUGE_ALLOCATION_SIZE) {
+        // Don't hold on to much more than asked for, e.g. a dictionary after a PPMd model.
+        if (retainedAllocation && retainedAllocation->mappedSize >= size
+                && retainedAllocation->mappedSize / 2 <= size) {
+            pointer = retainedAllocation->pointer;
+            allocation->mappedSize = retainedAllocation->mappedSize;
+            __real_free(retainedAllocation);
+            if (zero) {
+                memset(pointer, 0, size);
+            }
+        } else {
+            if (retainedAllocation) {
+                releaseLargeAllocation(retainedAllocation);
+            }
+            // Anonymous mappings are already zeroed.
+            pointer = mapHugeAllocation(size, &allocation->mappedSize);
+        }
+    } else if (retainedAllocation) {
+        releaseLargeAllocation(retainedAllocation);
+    }
+    if (!pointer) {
+        pointer = zero ? __real_calloc(1, size) : __real_malloc(size);
+    }
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    if (!pointer) {
+        if (memory) {
+            memory->currentSize -= size;
+        }
+        pthread_mutex_unlock(&gLargeAllocationsMutex);
+        __real_free(allocation);
+        return NULL;
+    }
+    allocation->pointer = pointer;
+    size_t bucket = getLargeAllocationBucket(pointer);
+    allocation->next = gLargeAllocations[bucket];
+    gLargeAllocations[bucket] = allocation;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    return pointer;
+}
+
+// Removes the allocation from the table and returns whether the pointer was a large allocation. A
+// mapped allocation is retained by its memory instead of being returned in outReleasedAllocation,
+// which is then the previously retained one if any.
+static bool removeLargeAllocation(void *pointer, struct LargeAllocation **outReleasedAllocation) {
+    *outReleasedAllocation = NULL;
+    if (!mayBeLargeAllocation(pointer)) {
+        return false;
+    }
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    struct LargeAllocation **link = &gLargeAllocations[getLargeAllocationBucket(pointer)];
+    while (*link && (*link)->pointer != pointer) {
+        link = &(*link)->next;
+    }
+    struct LargeAllocation *allocation = *link;
+    if (allocation) {
+        *link = allocation->next;
+        struct ArchiveMemory *memory = allocation->memory;
+        if (memory && allocation->mappedSize) {
+            // The retained allocation stays in the current size.
+            *outReleasedAllocation = takeRetainedAllocation(memory);
+            memory->retainedAllocation = allocation;
+        } else {
+            if (memory) {
+                memory->currentSize -= allocation->size;
+            }
+            *outReleasedAllocation = allocation;
+        }
+    }
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    return allocation != NULL;
+}
+
+static struct LargeAllocation *findLargeAllocationLocked(void *pointer) {
+    for (struct LargeAllocation *allocation = gLargeAllocations[getLargeAllocationBucket(pointer)];
+            allocation; allocation = allocation->next) {
+        if (allocation->pointer == pointer) {
+            return allocation;
+        }
+    }
+    return NULL;
+}
+
+static size_t getLargeAllocationSize(void *pointer) {
+    if (!mayBeLargeAllocation(pointer)) {
+        return 0;
+    }
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    struct LargeAllocation *allocation = findLargeAllocationLocked(pointer);
+    size_t size = allocation ? allocation->size : 0;
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    return size;
+}
+
+bool archiveMemoryMoveToCurrent(void *const *pointers, size_t count) {
+    struct ArchiveMemory *memory = getCurrentMemory();
+    pthread_mutex_lock(&gLargeAllocationsMutex);
+    size_t movedSize = 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct LargeAllocation *allocation = findLargeAllocationLocked(pointers[i]);
+        if (allocation && allocation->memory != memory) {
+            movedSize += allocation->size;
+        }
+    }
+    if (memory && exceedsBudget(memory, movedSize)) {
+        pthread_mutex_unlock(&gLargeAllocationsMutex);
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        struct LargeAllocation *allocation = findLargeAllocationLocked(pointers[i]);
+        if (!allocation || allocation->memory == memory) {
+            continue;
+        }
+        if (allocation->memory) {
+            allocation->memory->currentSize -= allocation->size;
+        }
+        allocation->memory = memory;
+    }
+    if (memory) {
+        memory->currentSize += movedSize;
+        if (memory->peakSize < memory->currentSize) {
+            memory->peakSize = memory->currentSize;
+        }
+    }
+    pthread_mutex_unlock(&gLargeAllocationsMutex);
+    return true;
+}
+
+// Allocates a small block from the free lists of the current memory, or from the system rounded up
+// to its class so that it fits the same class once freed.
+static void *allocateSmall(size_t size) {
+    if (!size || size > SMALL_BLOCK_CLASS_COUNT * SMALL_BLOCK_CLASS_SIZE) {
+        return __real_malloc(size);
+    }
+    struct ArchiveMemory *memory = getCurrentMemory();
+    if (!memory) {
+        return __real_malloc(size);
+    }
+    size_t class = (size - 1) / SMALL_BLOCK_CLASS_SIZE;
+    struct SmallBlock *block = memory->smallBlocks[class];
+    if (!block) {
+        return __real_malloc((class + 1) * SMALL_BLOCK_CLASS_SIZE);
+    }
+    memory->smallBlocks[class] = block->next;
+    --memory->smallBlockCounts[class];
+    return block;
+}
+
+static bool putSmallBlock(void *pointer) {
+    size_t usableSize = malloc_usable_size(pointer);
+    if (usableSize < SMALL_BLOCK_CLASS_SIZE
+            || usableSize >= (SMALL_BLOCK_CLASS_COUNT + 1) * SMALL_BLOCK_CLASS_SIZE) {
+        return false;
+    }
+    struct ArchiveMemory *memory = getCurrentMemory();
+    if (!memory) {
+        return false;
+    }
+    size_t class = usableSize / SMALL_BLOCK_CLASS_SIZE - 1;
+    if (memory->smallBlockCounts[class] >= SMALL_BLOCK_CLASS_CAPACITY) {
+        return false;
+    }
+    struct SmallBlock *block = pointer;
+    block->next = memory->smallBlocks[class];
+    memory->smallBlocks[class] = block;
+    ++memory->smallBlockCounts[class];
+    return true;
+}
+
+void *__wrap_malloc(size_t size) {
+    if (size < LARGE_ALLOCATION_SIZE) {
+        return allocateSmall(size);
+    }
+    return allocateLarge(size, false);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (count * size < LARGE_ALLOCATION_SIZE) {
+        void *pointer = allocateSmall(count * size);
+        if (pointer) {
+            memset(pointer, 0, count * size);
+        }
+        return pointer;
+    }
+    return allocateLarge(count * size, true);
+}
+
+void __wrap_free(void *pointer) {
+    if (!pointer) {
+        return;
+    }
+    struct LargeAllocation *releasedAllocation;
+    if (removeLargeAllocation(pointer, &releasedAllocation)) {
+        if (releasedAllocation) {
+            releaseLargeAllocation(releasedAllocation);
+        }
+        return;
+    }
+    if (putSmallBlock(pointer)) {
+        return;
+    }
+    __real_free(pointer);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    if (!pointer) {
+        return __wrap_malloc(size);
+    }
+    size_t oldSize = getLargeAllocationSize(pointer);
+    if (!oldSize && size < LARGE_ALLOCATION_SIZE) {
+        return __real_realloc(pointer, size);
+    }
+    // Large blocks are moved to keep them accounted in one place, which is also what the system
+    // allocator does for them most of the time.
+    if (!oldSize) {
+        oldSize = malloc_usable_size(pointer);
+    }
+    void *newPointer = __wrap_malloc(size);
+    if (!newPointer) {
+        return NULL;
+    }
+    memcpy(newPointer, pointer, oldSize < size ? oldSize : size);
+    __wrap_free(pointer);
+    return newPointer;
+}
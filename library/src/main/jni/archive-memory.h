@@ -0,0 +1,61 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Per-archive accounting for large native allocations, see archive-memory.c.
+
+#ifndef LIBARCHIVE_ANDROID_ARCHIVE_MEMORY_H
+#define LIBARCHIVE_ANDROID_ARCHIVE_MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct ArchiveMemory;
+
+struct ArchiveMemory *archiveMemoryNew(void);
+
+// Allocations still owned by the memory are no longer accounted to anything afterwards.
+void archiveMemoryFree(struct ArchiveMemory *memory);
+
+// Large allocations that would take the current size over a non-zero budget fail with ENOMEM.
+void archiveMemorySetBudget(struct ArchiveMemory *memory, size_t budget);
+
+// Returns whether an allocation was refused for the budget of the current memory on this thread
+// since it was entered, and clears that.
+bool archiveMemoryTakeBudgetExceeded(void);
+
+void archiveMemoryGetStats(struct ArchiveMemory *memory, size_t *outCurrentSize,
+                           size_t *outPeakSize);
+
+// Moves large allocations, e.g. those of a pooled codec stream, to the current memory on this
+// thread, or makes them unowned if there is none. Returns false without moving anything if that
+// would take the current memory over its budget.
+bool archiveMemoryMoveToCurrent(void *const *pointers, size_t count);
+
+// Makes the memory own the large allocations on this thread until the matching leave, and returns
+// the previous memory for it.
+struct ArchiveMemory *archiveMemoryEnter(struct ArchiveMemory *memory);
+
+void archiveMemoryLeave(struct ArchiveMemory **previousMemory);
+
+// Returns the memory entered on this thread, which also tells a hook which archive it's called for.
+struct ArchiveMemory *archiveMemoryGetCurrent(void);
+
+// Accounts large allocations to the memory until the end of the enclosing block.
+#define ARCHIVE_MEMORY_SCOPE(memory) \
+    struct ArchiveMemory *archiveMemoryPrevious __attribute__((cleanup(archiveMemoryLeave))) \
+            = archiveMemoryEnter(memory)
+
+#endif // LIBARCHIVE_ANDROID_ARCHIVE_MEMORY_H
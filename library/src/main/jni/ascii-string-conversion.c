@@ -0,0 +1,183 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Skips charset conversion of plain ASCII entry names, hooked in with the linker's --wrap.
+//
+// Readers convert every name they copy into an entry with the string conversion of its header,
+// e.g. from UTF-8 for pax paths and GNU long names with hdrcharset, which normalizes and validates
+// the name one character at a time even when it's all ASCII. When both charsets of a conversion
+// encode ASCII as itself, an ASCII name converts to the same bytes, so it's copied without the
+// conversion instead. Conversions are recorded as such when a reader asks for them, and forgotten
+// when their archive frees them.
+//
+// Names are copied for every entry on every thread, so conversions are looked up in a small table
+// of atomics without any lock. A conversion is only used by the thread of its archive, and is only
+// freed with it.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <archive.h>
+
+#define MAX_ASCII_CONVERSION_COUNT 64
+
+struct archive_mstring;
+struct archive_string_conv;
+
+struct archive_string_conv *__real_archive_string_conversion_from_charset(
+        struct archive *archive, const char *charset, int best_effort);
+void __real_archive_string_conversion_free(struct archive *archive);
+int __real_archive_mstring_copy_mbs_len_l(struct archive_mstring *aes, const char *mbs,
+                                          size_t len, struct archive_string_conv *sc);
+
+struct AsciiConversion {
+    _Atomic(struct archive_string_conv *) conversion;
+    _Atomic(struct archive *) archive;
+};
+
+static struct AsciiConversion gAsciiConversions[MAX_ASCII_CONVERSION_COUNT];
+// Keeps copying a name to a single load when there are no ASCII conversions.
+static atomic_size_t gAsciiConversionCount = 0;
+
+// Charsets that encode every ASCII character as the same single byte. Dashes and underscores are
+// ignored, like iconv does.
+static bool isAsciiCompatibleCharset(const char *charset) {
+    if (!charset) {
+        return false;
+    }
+    char name[32];
+    size_t length = 0;
+    for (; *charset && length < sizeof(name) - 1; ++charset) {
+        if (*charset != '-' && *charset != '_') {
+            name[length++] = *charset;
+        }
+    }
+    if (*charset) {
+        return false;
+    }
+    name[length] = '\0';
+    static const char *const NAMES[] = {
+        "ANSIX3.41968", "ASCII", "GB18030", "GBK", "USASCII", "UTF8"
+    };
+    for (size_t i = 0; i < sizeof(NAMES) / sizeof(*NAMES); ++i) {
+        if (!strcasecmp(name, NAMES[i])) {
+            return true;
+        }
+    }
+    // ISO-8859-n and windows-125n.
+    return (!strncasecmp(name, "ISO8859", 7) && length > 7)
+            || (!strncasecmp(name, "CP125", 5) && length == 6)
+            || (!strncasecmp(name, "WINDOWS125", 10) && length == 11);
+}
+
+static bool isAsciiConversion(struct archive_string_conv *conversion) {
+    if (!atomic_load(&gAsciiConversionCount)) {
+        return false;
+    }
+    for (size_t i = 0; i < MAX_ASCII_CONVERSION_COUNT; ++i) {
+        if (atomic_load(&gAsciiConversions[i].conversion) == conversion) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void addAsciiConversion(struct archive *archive, struct archive_string_conv *conversion) {
+    if (isAsciiConversion(conversion)) {
+        return;
+    }
+    for (size_t i = 0; i < MAX_ASCII_CONVERSION_COUNT; ++i) {
+        struct AsciiConversion *asciiConversion = &gAsciiConversions[i];
+        struct archive_string_conv *freeConversion = NULL;
+        if (atomic_compare_exchange_strong(&asciiConversion->conversion, &freeConversion,
+                                           conversion)) {
+            atomic_store(&asciiConversion->archive, archive);
+            atomic_fetch_add(&gAsciiConversionCount, 1);
+            return;
+        }
+    }
+}
+
+static void removeAsciiConversions(struct archive *archive) {
+    if (!atomic_load(&gAsciiConversionCount)) {
+        return;
+    }
+    for (size_t i = 0; i < MAX_ASCII_CONVERSION_COUNT; ++i) {
+        struct AsciiConversion *asciiConversion = &gAsciiConversions[i];
+        if (atomic_load(&asciiConversion->archive) == archive) {
+            atomic_store(&asciiConversion->archive, NULL);
+            atomic_store(&asciiConversion->conversion, NULL);
+            atomic_fetch_sub(&gAsciiConversionCount, 1);
+        }
+    }
+}
+
+// Returns whether the string up to its length or its first NUL is all ASCII, checking a word at a
+// time.
+static bool isAsciiString(const char *string, size_t length) {
+    const uint64_t ONES = 0x0101010101010101;
+    const uint64_t HIGH_BITS = 0x8080808080808080;
+    size_t i = 0;
+    for (; length - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, string + i, sizeof(word));
+        uint64_t nonAsciiBits = word & HIGH_BITS;
+        // Exact up to the first NUL, which is all that matters.
+        uint64_t nulBits = (word - ONES) & ~word & HIGH_BITS;
+        if (nulBits) {
+            // Only non-ASCII bytes before the NUL count, in little-endian byte order.
+            return !nonAsciiBits || __builtin_ctzll(nulBits) < __builtin_ctzll(nonAsciiBits);
+        }
+        if (nonAsciiBits) {
+            return false;
+        }
+    }
+    for (; i < length && string[i]; ++i) {
+        if ((unsigned char) string[i] >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct archive_string_conv *__wrap_archive_string_conversion_from_charset(
+        struct archive *archive, const char *charset, int best_effort) {
+    struct archive_string_conv *conversion = __real_archive_string_conversion_from_charset(
+            archive, charset, best_effort);
+    // The conversion is to the charset of the archive, which libarchive has set to that of the
+    // locale by now if there was none.
+    if (archive && conversion && isAsciiCompatibleCharset(charset)
+            && isAsciiCompatibleCharset(archive_charset(archive))) {
+        addAsciiConversion(archive, conversion);
+    }
+    return conversion;
+}
+
+void __wrap_archive_string_conversion_free(struct archive *archive) {
+    removeAsciiConversions(archive);
+    __real_archive_string_conversion_free(archive);
+}
+
+int __wrap_archive_mstring_copy_mbs_len_l(struct archive_mstring *aes, const char *mbs,
+                                          size_t len, struct archive_string_conv *sc) {
+    if (sc && mbs && isAsciiConversion(sc) && isAsciiString(mbs, len)) {
+        sc = NULL;
+    }
+    return __real_archive_mstring_copy_mbs_len_l(aes, mbs, len, sc);
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SIMD BLAKE2sp for the RAR5 reader, hooked in with the linker's --wrap.
+//
+// The eight BLAKE2s leaves of BLAKE2sp are independent, so four of them are compressed at once
+// with one leaf per vector lane. Only whole 512-byte stripes are handled here, and everything else
+// (the first stripe, partial stripes and finalization) is left to libarchive's reference code,
+// which also defines the state layout. NEON and SSSE3 are both part of the respective Android ABI
+// baselines, so no runtime detection is needed for them, while AVX2 compresses all eight leaves at
+// once when cpuid reports it.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <archive_blake2.h>
+
+#include "cpu-features.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_BLAKE2SP_SIMD 1
+#elif defined(__SSSE3__)
+#include <immintrin.h>
+#define HAVE_BLAKE2SP_SIMD 1
+#define HAVE_BLAKE2SP_AVX2 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define BLAKE2SP_LEAF_COUNT 8
+#define BLAKE2SP_STRIPE_SIZE (BLAKE2SP_LEAF_COUNT * BLAKE2S_BLOCKBYTES)
+
+int __real_blake2sp_update(blake2sp_state *S, const void *pin, size_t inlen);
+
+#if defined(HAVE_BLAKE2SP_SIMD)
+
+static const uint32_t BLAKE2S_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t BLAKE2S_SIGMA[10][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+};
+
+#if defined(__ARM_NEON)
+
+typedef uint32x4_t Vector;
+
+#define vectorAdd(a, b) vaddq_u32(a, b)
+#define vectorXor(a, b) veorq_u32(a, b)
+#define vectorBroadcast(x) vdupq_n_u32(x)
+#define vectorLoad(p) vld1q_u32((const uint32_t *) (p))
+#define vectorStore(p, a) vst1q_u32((uint32_t *) (p), a)
+#define vectorRotateRight16(a) vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(a)))
+#define vectorRotateRight(a, n) vsriq_n_u32(vshlq_n_u32(a, 32 - (n)), a, n)
+#define vectorRotateRight8(a) vectorRotateRight(a, 8)
+
+// Turns four rows of four words into four columns.
+static inline void vectorTranspose(Vector *r0, Vector *r1, Vector *r2, Vector *r3) {
+    uint32x4x2_t t01 = vtrnq_u32(*r0, *r1);
+    uint32x4x2_t t23 = vtrnq_u32(*r2, *r3);
+    *r0 = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+    *r1 = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+    *r2 = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+    *r3 = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+}
+
+#else // __SSSE3__
+
+typedef __m128i Vector;
+
+#define vectorAdd(a, b) _mm_add_epi32(a, b)
+#define vectorXor(a, b) _mm_xor_si128(a, b)
+#define vectorBroadcast(x) _mm_set1_epi32((int) (x))
+#define vectorLoad(p) _mm_loadu_si128((const __m128i *) (p))
+#define vectorStore(p, a) _mm_storeu_si128((__m128i *) (p), a)
+#define vectorRotateRight16(a) \
+    _mm_shuffle_epi8(a, _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2))
+#define vectorRotateRight8(a) \
+    _mm_shuffle_epi8(a, _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1))
+#define vectorRotateRight(a, n) _mm_or_si128(_mm_srli_epi32(a, n), _mm_slli_epi32(a, 32 - (n)))
+
+// Turns four rows of four words into four columns.
+static inline void vectorTranspose(Vector *r0, Vector *r1, Vector *r2, Vector *r3) {
+    __m128i t0 = _mm_unpacklo_epi32(*r0, *r1);
+    __m128i t1 = _mm_unpacklo_epi32(*r2, *r3);
+    __m128i t2 = _mm_unpackhi_epi32(*r0, *r1);
+    __m128i t3 = _mm_unpackhi_epi32(*r2, *r3);
+    *r0 = _mm_unpacklo_epi64(t0, t1);
+    *r1 = _mm_unpackhi_epi64(t0, t1);
+    *r2 = _mm_unpacklo_epi64(t2, t3);
+    *r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+#endif
+
+#define G(a, b, c, d, x, y) \
+    do { \
+        a = vectorAdd(vectorAdd(a, b), x); \
+        d = vectorRotateRight16(vectorXor(d, a)); \
+        c = vectorAdd(c, d); \
+        b = vectorRotateRight(vectorXor(b, c), 12); \
+        a = vectorAdd(vectorAdd(a, b), y); \
+        d = vectorRotateRight8(vectorXor(d, a)); \
+        c = vectorAdd(c, d); \
+        b = vectorRotateRight(vectorXor(b, c), 7); \
+    } while (0)
+
+// Compresses one block for each of four leaves, with the leaves in the vector lanes. The leaves
+// are never the last block while updating, so the finalization flags are always zero.
+static void blake2sCompress4(Vector h[8], uint64_t counter, const uint8_t *blocks[4]) {
+    Vector m[16];
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            m[4 * i + j] = vectorLoad(blocks[j] + 16 * i);
+        }
+        vectorTranspose(&m[4 * i], &m[4 * i + 1], &m[4 * i + 2], &m[4 * i + 3]);
+    }
+    Vector v[16];
+    for (int i = 0; i < 8; ++i) {
+        v[i] = h[i];
+    }
+    for (int i = 0; i < 4; ++i) {
+        v[8 + i] = vectorBroadcast(BLAKE2S_IV[i]);
+    }
+    v[12] = vectorBroadcast(BLAKE2S_IV[4] ^ (uint32_t) counter);
+    v[13] = vectorBroadcast(BLAKE2S_IV[5] ^ (uint32_t) (counter >> 32));
+    v[14] = vectorBroadcast(BLAKE2S_IV[6]);
+    v[15] = vectorBroadcast(BLAKE2S_IV[7]);
+    for (int round = 0; round < 10; ++round) {
+        const uint8_t *s = BLAKE2S_SIGMA[round];
+        G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        h[i] = vectorXor(h[i], vectorXor(v[i], v[i + 8]));
+    }
+}
+
+// blake2s_update() in the reference code always keeps the latest block buffered, because it can't
+// know whether it will be the last one. So a leaf that is ready for the fast path has a full
+// buffer, and all leaves have the same counter because they advance in lockstep.
+static bool isBlake2spLeavesReady(const blake2sp_state *S) {
+    for (int i = 0; i < BLAKE2SP_LEAF_COUNT; ++i) {
+        const blake2s_state *leaf = S->S[i];
+        if (leaf->buflen != BLAKE2S_BLOCKBYTES || leaf->f[0] || leaf->f[1]
+                || leaf->t[0] != S->S[0]->t[0] || leaf->t[1] != S->S[0]->t[1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Processes stripeCount full stripes, leaving the last block of each leaf in its buffer as the
+// reference code would.
+static void blake2spUpdateStripes(blake2sp_state *S, const uint8_t *in, size_t stripeCount) {
+    uint64_t startCounter = ((uint64_t) S->S[0]->t[1] << 32) | S->S[0]->t[0];
+    uint64_t counter = startCounter;
+    for (int firstLeaf = 0; firstLeaf < BLAKE2SP_LEAF_COUNT; firstLeaf += 4) {
+        blake2s_state *leaves[4];
+        for (int i = 0; i < 4; ++i) {
+            leaves[i] = S->S[firstLeaf + i];
+        }
+        Vector h[8];
+        for (int i = 0; i < 8; ++i) {
+            uint32_t words[4] = { leaves[0]->h[i], leaves[1]->h[i], leaves[2]->h[i],
+                                  leaves[3]->h[i] };
+            h[i] = vectorLoad(words);
+        }
+        counter = startCounter;
+        const uint8_t *blocks[4];
+        for (int i = 0; i < 4; ++i) {
+            blocks[i] = leaves[i]->buf;
+        }
+        for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+            counter += BLAKE2S_BLOCKBYTES;
+            blake2sCompress4(h, counter, blocks);
+            for (int i = 0; i < 4; ++i) {
+                blocks[i] = in + stripe * BLAKE2SP_STRIPE_SIZE
+                        + (firstLeaf + i) * BLAKE2S_BLOCKBYTES;
+            }
+        }
+        for (int i = 0; i < 8; ++i) {
+            uint32_t words[4];
+            vectorStore(words, h[i]);
+            for (int j = 0; j < 4; ++j) {
+                leaves[j]->h[i] = words[j];
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            memcpy(leaves[i]->buf, blocks[i], BLAKE2S_BLOCKBYTES);
+            leaves[i]->t[0] = (uint32_t) counter;
+            leaves[i]->t[1] = (uint32_t) (counter >> 32);
+        }
+    }
+}
+
+#if defined(HAVE_BLAKE2SP_AVX2)
+
+#define rotateRight16Avx2(a) \
+    _mm256_shuffle_epi8(a, _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, \
+                                            2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13))
+#define rotateRight8Avx2(a) \
+    _mm256_shuffle_epi8(a, _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, \
+                                            1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12))
+#define rotateRightAvx2(a, n) \
+    _mm256_or_si256(_mm256_srli_epi32(a, n), _mm256_slli_epi32(a, 32 - (n)))
+
+#define G_AVX2(a, b, c, d, x, y) \
+    do { \
+        a = _mm256_add_epi32(_mm256_add_epi32(a, b), x); \
+        d = rotateRight16Avx2(_mm256_xor_si256(d, a)); \
+        c = _mm256_add_epi32(c, d); \
+        b = rotateRightAvx2(_mm256_xor_si256(b, c), 12); \
+        a = _mm256_add_epi32(_mm256_add_epi32(a, b), y); \
+        d = rotateRight8Avx2(_mm256_xor_si256(d, a)); \
+        c = _mm256_add_epi32(c, d); \
+        b = rotateRightAvx2(_mm256_xor_si256(b, c), 7); \
+    } while (0)
+
+// Like blake2sCompress4(), but for all eight leaves.
+TARGET_AVX2
+static void blake2sCompress8Avx2(__m256i h[8], uint64_t counter, const uint8_t *blocks[8]) {
+    __m256i m[16];
+    for (int half = 0; half < 2; ++half) {
+        __m256i r[8];
+        for (int i = 0; i < 8; ++i) {
+            r[i] = _mm256_loadu_si256((const __m256i *) (blocks[i] + 32 * half));
+        }
+        // Turns eight rows of eight words into eight columns.
+        __m256i t[8];
+        for (int i = 0; i < 8; i += 2) {
+            t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+            t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+        }
+        for (int i = 0; i < 8; i += 4) {
+            r[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+            r[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+            r[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+            r[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+        }
+        for (int i = 0; i < 4; ++i) {
+            m[8 * half + i] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x20);
+            m[8 * half + i + 4] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x31);
+        }
+    }
+    __m256i v[16];
+    for (int i = 0; i < 8; ++i) {
+        v[i] = h[i];
+    }
+    for (int i = 0; i < 4; ++i) {
+        v[8 + i] = _mm256_set1_epi32((int) BLAKE2S_IV[i]);
+    }
+    v[12] = _mm256_set1_epi32((int) (BLAKE2S_IV[4] ^ (uint32_t) counter));
+    v[13] = _mm256_set1_epi32((int) (BLAKE2S_IV[5] ^ (uint32_t) (counter >> 32)));
+    v[14] = _mm256_set1_epi32((int) BLAKE2S_IV[6]);
+    v[15] = _mm256_set1_epi32((int) BLAKE2S_IV[7]);
+    for (int round = 0; round < 10; ++round) {
+        const uint8_t *s = BLAKE2S_SIGMA[round];
+        G_AVX2(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G_AVX2(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G_AVX2(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G_AVX2(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G_AVX2(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G_AVX2(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G_AVX2(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G_AVX2(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+    }
+}
+
+// Like blake2spUpdateStripes(), but for all eight leaves at once.
+TARGET_AVX2
+static void blake2spUpdateStripesAvx2(blake2sp_state *S, const uint8_t *in, size_t stripeCount) {
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i) {
+        uint32_t words[BLAKE2SP_LEAF_COUNT];
+        for (int j = 0; j < BLAKE2SP_LEAF_COUNT; ++j) {
+            words[j] = S->S[j]->h[i];
+        }
+        h[i] = _mm256_loadu_si256((const __m256i *) words);
+    }
+    uint64_t counter = ((uint64_t) S->S[0]->t[1] << 32) | S->S[0]->t[0];
+    const uint8_t *blocks[BLAKE2SP_LEAF_COUNT];
+    for (int i = 0; i < BLAKE2SP_LEAF_COUNT; ++i) {
+        blocks[i] = S->S[i]->buf;
+    }
+    for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+        counter += BLAKE2S_BLOCKBYTES;
+        blake2sCompress8Avx2(h, counter, blocks);
+        for (int i = 0; i < BLAKE2SP_LEAF_COUNT; ++i) {
+            blocks[i] = in + stripe * BLAKE2SP_STRIPE_SIZE + i * BLAKE2S_BLOCKBYTES;
+        }
+    }
+    for (int i = 0; i < 8; ++i) {
+        uint32_t words[BLAKE2SP_LEAF_COUNT];
+        _mm256_storeu_si256((__m256i *) words, h[i]);
+        for (int j = 0; j < BLAKE2SP_LEAF_COUNT; ++j) {
+            S->S[j]->h[i] = words[j];
+        }
+    }
+    for (int i = 0; i < BLAKE2SP_LEAF_COUNT; ++i) {
+        blake2s_state *leaf = S->S[i];
+        memcpy(leaf->buf, blocks[i], BLAKE2S_BLOCKBYTES);
+        leaf->t[0] = (uint32_t) counter;
+        leaf->t[1] = (uint32_t) (counter >> 32);
+    }
+}
+
+#endif // HAVE_BLAKE2SP_AVX2
+
+#endif // HAVE_BLAKE2SP_SIMD
+
+int __wrap_blake2sp_update(blake2sp_state *S, const void *pin, size_t inlen) {
+#if defined(HAVE_BLAKE2SP_SIMD)
+    const uint8_t *in = pin;
+    if (S->buflen) {
+        size_t fill = sizeof(S->buf) - S->buflen;
+        if (inlen < fill + BLAKE2SP_STRIPE_SIZE) {
+            return __real_blake2sp_update(S, in, inlen);
+        }
+        __real_blake2sp_update(S, in, fill);
+        in += fill;
+        inlen -= fill;
+    }
+    if (inlen >= BLAKE2SP_STRIPE_SIZE && !isBlake2spLeavesReady(S)) {
+        __real_blake2sp_update(S, in, BLAKE2SP_STRIPE_SIZE);
+        in += BLAKE2SP_STRIPE_SIZE;
+        inlen -= BLAKE2SP_STRIPE_SIZE;
+    }
+    if (inlen >= BLAKE2SP_STRIPE_SIZE && !S->buflen && isBlake2spLeavesReady(S)) {
+        size_t stripeCount = inlen / BLAKE2SP_STRIPE_SIZE;
+#if defined(HAVE_BLAKE2SP_AVX2)
+        if (hasCpuFeatures(CPU_FEATURE_AVX2)) {
+            blake2spUpdateStripesAvx2(S, in, stripeCount);
+        } else {
+            blake2spUpdateStripes(S, in, stripeCount);
+        }
+#else
+        blake2spUpdateStripes(S, in, stripeCount);
+#endif
+        in += stripeCount * BLAKE2SP_STRIPE_SIZE;
+        inlen -= stripeCount * BLAKE2SP_STRIPE_SIZE;
+    }
+    return __real_blake2sp_update(S, in, inlen);
+#else
+    return __real_blake2sp_update(S, pin, inlen);
+#endif
+}
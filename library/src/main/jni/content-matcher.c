@@ -0,0 +1,214 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// An Aho-Corasick automaton compiled into a full transition table, so that scanning takes one
+// table lookup per byte and the state carries matches across buffer boundaries. While the
+// automaton is at its root and every pattern starts with the same byte, the scan skips ahead with
+// memchr(), which is vectorized in bionic.
+
+#include "content-matcher.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ALPHABET_SIZE 256
+
+struct ContentMatcher {
+    uint32_t *transitions;
+    // The pattern ending at each state, or -1.
+    int32_t *outputPatterns;
+    // The next state along the failure links that ends a pattern, or 0.
+    uint32_t *outputLinks;
+    size_t *patternLengths;
+    // The only byte that leaves the root state, or -1.
+    int firstByte;
+};
+
+static uint8_t toLowerAscii(uint8_t byte) {
+    return byte >= 'A' && byte <= 'Z' ? byte + ('a' - 'A') : byte;
+}
+
+static uint32_t buildTrie(struct ContentMatcher *matcher, const uint8_t *const *patterns,
+                          const size_t *patternLengths, size_t patternCount, bool ignoreCase) {
+    uint32_t stateCount = 1;
+    for (size_t i = 0; i < patternCount; ++i) {
+        uint32_t state = 0;
+        for (size_t j = 0; j < patternLengths[i]; ++j) {
+            uint8_t byte = ignoreCase ? toLowerAscii(patterns[i][j]) : patterns[i][j];
+            uint32_t *transition = &matcher->transitions[state * ALPHABET_SIZE + byte];
+            // No edge in the trie goes back to the root, so 0 means there is no edge yet.
+            if (!*transition) {
+                *transition = stateCount++;
+            }
+            state = *transition;
+        }
+        // Identical patterns are only reported once, for the first of them.
+        if (matcher->outputPatterns[state] < 0) {
+            matcher->outputPatterns[state] = (int32_t) i;
+        }
+    }
+    return stateCount;
+}
+
+// Turns the trie into the automaton by resolving the failure links in breadth first order.
+static bool buildAutomaton(struct ContentMatcher *matcher, uint32_t stateCount) {
+    uint32_t *failures = calloc(stateCount, sizeof(*failures));
+    uint32_t *queue = malloc(stateCount * sizeof(*queue));
+    if (!failures || !queue) {
+        free(failures);
+        free(queue);
+        return false;
+    }
+    size_t queueHead = 0;
+    size_t queueTail = 0;
+    for (int byte = 0; byte < ALPHABET_SIZE; ++byte) {
+        uint32_t child = matcher->transitions[byte];
+        if (child) {
+            queue[queueTail++] = child;
+        }
+    }
+    while (queueHead < queueTail) {
+        uint32_t state = queue[queueHead++];
+        uint32_t failure = failures[state];
+        matcher->outputLinks[state] = matcher->outputPatterns[failure] >= 0 ? failure
+                : matcher->outputLinks[failure];
+        uint32_t *transitions = &matcher->transitions[state * ALPHABET_SIZE];
+        const uint32_t *failureTransitions = &matcher->transitions[failure * ALPHABET_SIZE];
+        for (int byte = 0; byte < ALPHABET_SIZE; ++byte) {
+            uint32_t child = transitions[byte];
+            if (child) {
+                failures[child] = failureTransitions[byte];
+                queue[queueTail++] = child;
+            } else {
+                transitions[byte] = failureTransitions[byte];
+            }
+        }
+    }
+    free(failures);
+    free(queue);
+    return true;
+}
+
+struct ContentMatcher *contentMatcherNew(const uint8_t *const *patterns,
+                                         const size_t *patternLengths, size_t patternCount,
+                                         bool ignoreCase) {
+    if (!patternCount) {
+        return NULL;
+    }
+    size_t totalLength = 0;
+    for (size_t i = 0; i < patternCount; ++i) {
+        if (!patternLengths[i] || patternLengths[i] > CONTENT_MATCHER_MAX_TOTAL_LENGTH) {
+            return NULL;
+        }
+        totalLength += patternLengths[i];
+        if (totalLength > CONTENT_MATCHER_MAX_TOTAL_LENGTH) {
+            return NULL;
+        }
+    }
+    struct ContentMatcher *matcher = calloc(1, sizeof(*matcher));
+    if (!matcher) {
+        return NULL;
+    }
+    size_t maxStateCount = totalLength + 1;
+    matcher->transitions = calloc(maxStateCount * ALPHABET_SIZE, sizeof(*matcher->transitions));
+    matcher->outputPatterns = malloc(maxStateCount * sizeof(*matcher->outputPatterns));
+    matcher->outputLinks = calloc(maxStateCount, sizeof(*matcher->outputLinks));
+    matcher->patternLengths = malloc(patternCount * sizeof(*matcher->patternLengths));
+    if (!matcher->transitions || !matcher->outputPatterns || !matcher->outputLinks
+            || !matcher->patternLengths) {
+        contentMatcherFree(matcher);
+        return NULL;
+    }
+    memcpy(matcher->patternLengths, patternLengths, patternCount * sizeof(*patternLengths));
+    for (size_t i = 0; i < maxStateCount; ++i) {
+        matcher->outputPatterns[i] = -1;
+    }
+    uint32_t stateCount = buildTrie(matcher, patterns, patternLengths, patternCount, ignoreCase);
+    if (!buildAutomaton(matcher, stateCount)) {
+        contentMatcherFree(matcher);
+        return NULL;
+    }
+    if (ignoreCase) {
+        // The trie only has lower case edges, so upper case input behaves the same.
+        for (uint32_t state = 0; state < stateCount; ++state) {
+            uint32_t *transitions = &matcher->transitions[state * ALPHABET_SIZE];
+            memcpy(&transitions['A'], &transitions['a'], ('Z' - 'A' + 1) * sizeof(*transitions));
+        }
+    }
+    matcher->firstByte = -1;
+    for (int byte = 0; byte < ALPHABET_SIZE; ++byte) {
+        if (matcher->transitions[byte]) {
+            if (matcher->firstByte != -1) {
+                matcher->firstByte = -1;
+                break;
+            }
+            matcher->firstByte = byte;
+        }
+    }
+    return matcher;
+}
+
+void contentMatcherFree(struct ContentMatcher *matcher) {
+    if (!matcher) {
+        return;
+    }
+    free(matcher->transitions);
+    free(matcher->outputPatterns);
+    free(matcher->outputLinks);
+    free(matcher->patternLengths);
+    free(matcher);
+}
+
+size_t contentMatcherScan(const struct ContentMatcher *matcher, uint32_t *state,
+                          const uint8_t *buffer, size_t size) {
+    const uint32_t *transitions = matcher->transitions;
+    const int32_t *outputPatterns = matcher->outputPatterns;
+    const uint32_t *outputLinks = matcher->outputLinks;
+    uint32_t currentState = *state;
+    size_t position = 0;
+    while (position < size) {
+        if (!currentState && matcher->firstByte != -1) {
+            const uint8_t *first = memchr(buffer + position, matcher->firstByte, size - position);
+            if (!first) {
+                position = size;
+                break;
+            }
+            position = first - buffer;
+        }
+        currentState = transitions[currentState * ALPHABET_SIZE + buffer[position++]];
+        if (outputPatterns[currentState] >= 0 || outputLinks[currentState]) {
+            break;
+        }
+    }
+    *state = currentState;
+    return position;
+}
+
+uint32_t contentMatcherGetFirstOutput(const struct ContentMatcher *matcher, uint32_t state) {
+    return matcher->outputPatterns[state] >= 0 ? state : matcher->outputLinks[state];
+}
+
+uint32_t contentMatcherGetNextOutput(const struct ContentMatcher *matcher, uint32_t output) {
+    return matcher->outputLinks[output];
+}
+
+size_t contentMatcherGetOutputPattern(const struct ContentMatcher *matcher, uint32_t output) {
+    return (size_t) matcher->outputPatterns[output];
+}
+
+size_t contentMatcherGetPatternLength(const struct ContentMatcher *matcher, size_t pattern) {
+    return matcher->patternLengths[pattern];
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A multi-pattern byte string matcher for searching decompressed entry data as it streams by.
+
+#ifndef LIBARCHIVE_ANDROID_CONTENT_MATCHER_H
+#define LIBARCHIVE_ANDROID_CONTENT_MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The longest total length of patterns, which bounds the size of the automaton.
+#define CONTENT_MATCHER_MAX_TOTAL_LENGTH 4096
+
+struct ContentMatcher;
+
+// Returns NULL if any pattern is empty, the patterns are too long, or allocation failed. Case is
+// only ignored for ASCII letters.
+struct ContentMatcher *contentMatcherNew(const uint8_t *const *patterns,
+                                         const size_t *patternLengths, size_t patternCount,
+                                         bool ignoreCase);
+
+void contentMatcherFree(struct ContentMatcher *matcher);
+
+// Scans the buffer starting from *state, which is 0 at the start of the data. Returns the number of
+// bytes consumed, which is less than size if the last byte consumed completed any match, and the
+// outputs of *state should then be reported before scanning the rest.
+size_t contentMatcherScan(const struct ContentMatcher *matcher, uint32_t *state,
+                          const uint8_t *buffer, size_t size);
+
+// Returns the first output of the state, or 0 if the state doesn't complete any match.
+uint32_t contentMatcherGetFirstOutput(const struct ContentMatcher *matcher, uint32_t state);
+
+// Returns the next output after the output, or 0 if there is none.
+uint32_t contentMatcherGetNextOutput(const struct ContentMatcher *matcher, uint32_t output);
+
+// Returns the index of the pattern matched by the output.
+size_t contentMatcherGetOutputPattern(const struct ContentMatcher *matcher, uint32_t output);
+
+size_t contentMatcherGetPatternLength(const struct ContentMatcher *matcher, size_t pattern);
+
+#endif // LIBARCHIVE_ANDROID_CONTENT_MATCHER_H
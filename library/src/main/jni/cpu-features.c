@@ -0,0 +1,143 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cpu-features.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define XCR0_SSE_AVX 0x6
+
+static unsigned int getXcr0(void) {
+    unsigned int eax, edx;
+    __asm__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+}
+#endif
+
+static pthread_once_t gCpuFeaturesOnce = PTHREAD_ONCE_INIT;
+static unsigned int gCpuFeatures;
+
+static void initCpuFeatures(void) {
+    unsigned int features = 0;
+#if defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if (hwcap & HWCAP_AES) {
+        features |= CPU_FEATURE_AES;
+    }
+    if (hwcap & HWCAP_PMULL) {
+        features |= CPU_FEATURE_PMULL;
+    }
+    if (hwcap & HWCAP_SHA1) {
+        features |= CPU_FEATURE_SHA1;
+    }
+    if (hwcap & HWCAP_SHA2) {
+        features |= CPU_FEATURE_SHA2;
+    }
+    if (hwcap & HWCAP_CRC32) {
+        features |= CPU_FEATURE_CRC32;
+    }
+#elif defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if (ecx & bit_AES) {
+            features |= CPU_FEATURE_AES;
+        }
+        if (ecx & bit_PCLMUL) {
+            features |= CPU_FEATURE_PMULL;
+        }
+        // The SHA-NI code paths also use SSSE3 and SSE4.1 instructions.
+        bool hasSse = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+        // AVX2 also needs the OS to save the YMM registers on context switches.
+        bool hasYmmState = (ecx & bit_OSXSAVE) && (getXcr0() & XCR0_SSE_AVX) == XCR0_SSE_AVX;
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            if (hasSse && (ebx & bit_SHA)) {
+                features |= CPU_FEATURE_SHA1 | CPU_FEATURE_SHA2;
+            }
+            if (hasYmmState && (ebx & bit_AVX2)) {
+                features |= CPU_FEATURE_AVX2;
+            }
+            if (ebx & bit_BMI2) {
+                features |= CPU_FEATURE_BMI2;
+            }
+        }
+    }
+#endif
+    gCpuFeatures = features;
+}
+
+unsigned int getCpuFeatures(void) {
+    pthread_once(&gCpuFeaturesOnce, initCpuFeatures);
+    return gCpuFeatures;
+}
+
+void getCpuDispatchDescription(char *buffer, size_t size) {
+    unsigned int features = getCpuFeatures();
+    const char *aes = "C";
+    const char *sha1 = "C";
+    const char *sha256 = "C";
+    const char *blake2sp = "C";
+    const char *crc = "C";
+    const char *huffman = "C";
+#if defined(__aarch64__)
+    if (features & CPU_FEATURE_AES) {
+        aes = "ARMv8";
+    }
+    if (features & CPU_FEATURE_SHA1) {
+        sha1 = "ARMv8";
+    }
+    if (features & CPU_FEATURE_SHA2) {
+        sha256 = "ARMv8";
+    }
+    blake2sp = "NEON";
+    // liblzma checks HWCAP_CRC32 itself.
+    if (features & CPU_FEATURE_CRC32) {
+        crc = "ARMv8";
+    }
+#elif defined(__i386__) || defined(__x86_64__)
+#if defined(__x86_64__)
+    // mbedcrypto has its own AES-NI code on x86_64 only.
+    if (features & CPU_FEATURE_AES) {
+        aes = "AES-NI";
+    }
+    // zstd checks BMI2 itself, and only uses its assembly Huffman decoder with BMI2.
+    if (features & CPU_FEATURE_BMI2) {
+        huffman = "BMI2";
+    }
+#endif
+    if (features & CPU_FEATURE_SHA1) {
+        sha1 = "SHA-NI";
+    }
+    if (features & CPU_FEATURE_SHA2) {
+        sha256 = "SHA-NI";
+    }
+    blake2sp = features & CPU_FEATURE_AVX2 ? "AVX2" : "SSSE3";
+    // liblzma checks CLMUL itself.
+    if (features & CPU_FEATURE_PMULL) {
+        crc = "CLMUL";
+    }
+#endif
+    snprintf(buffer, size, "AES: %s, SHA-1: %s, SHA-256: %s, BLAKE2sp: %s, CRC: %s, Huffman: %s",
+             aes, sha1, sha256, blake2sp, crc, huffman);
+}
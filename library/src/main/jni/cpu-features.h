@@ -0,0 +1,45 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBARCHIVE_ANDROID_CPU_FEATURES_H
+#define LIBARCHIVE_ANDROID_CPU_FEATURES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// AES, PMULL, SHA1, SHA2 and CRC32 map to the ARMv8 HWCAP bits on arm64, and to AES-NI, PCLMULQDQ
+// and SHA-NI on x86. AVX2 and BMI2 are x86 only.
+enum {
+    CPU_FEATURE_AES = 1 << 0,
+    CPU_FEATURE_PMULL = 1 << 1,
+    CPU_FEATURE_SHA1 = 1 << 2,
+    CPU_FEATURE_SHA2 = 1 << 3,
+    CPU_FEATURE_CRC32 = 1 << 4,
+    CPU_FEATURE_AVX2 = 1 << 5,
+    CPU_FEATURE_BMI2 = 1 << 6,
+};
+
+unsigned int getCpuFeatures(void);
+
+// Describes the variant chosen for each accelerated kernel, both ours and the ones that the codec
+// libraries dispatch internally, e.g. "AES: ARMv8, SHA-1: ARMv8, ...".
+void getCpuDispatchDescription(char *buffer, size_t size);
+
+static inline bool hasCpuFeatures(unsigned int features) {
+    return (getCpuFeatures() & features) == features;
+}
+
+#endif // LIBARCHIVE_ANDROID_CPU_FEATURES_H
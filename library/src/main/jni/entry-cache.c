@@ -0,0 +1,423 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Items live in a chained hash table and in one of two LRU lists, one for content kept as is and
+// one for content kept compressed with LZ4. An item that falls off the first list is compressed
+// into the second, and one that falls off the second is dropped. A hit on a compressed item
+// decompresses it back into the first list, so that repeated reads of the same pages don't pay for
+// LZ4 either. Items are reference counted, so that a reader can copy the content out without
+// holding the lock while another thread evicts it.
+//
+// LZ4 runs without the lock, so that compressing a large evicted item doesn't block every other
+// thread. An evicted item is taken out of the table and linked back in once compressed, unless the
+// cache was invalidated or the key was put again meanwhile. An item being decompressed stays in the
+// table with a reference held, and other threads miss on it until it's done.
+
+#include "entry-cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lz4.h>
+
+#define BUCKET_COUNT 1024
+
+struct EntryCacheItem {
+    // The archive key followed by the pathname.
+    uint8_t *key;
+    size_t archiveKeySize;
+    size_t keySize;
+    uint64_t hash;
+    // Either the content or its LZ4 compressed form.
+    uint8_t *data;
+    size_t dataSize;
+    size_t contentSize;
+    bool isCompressed;
+    bool isDecompressing;
+    // Removed items are freed once the last reference is released.
+    bool isRemoved;
+    size_t referenceCount;
+    struct EntryCacheItem *bucketNext;
+    struct EntryCacheItem *lruPrevious;
+    struct EntryCacheItem *lruNext;
+};
+
+// The head is the most recently used item.
+struct LruList {
+    struct EntryCacheItem *head;
+    struct EntryCacheItem *tail;
+    size_t size;
+    size_t limit;
+};
+
+static pthread_mutex_t gEntryCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct EntryCacheItem *gBuckets[BUCKET_COUNT];
+static struct LruList gContentList;
+static struct LruList gCompressedList;
+// Incremented on invalidation, so that items compressed meanwhile aren't linked back.
+static uint64_t gInvalidationCount;
+
+static uint64_t hashKey(const uint8_t *archiveKey, size_t archiveKeySize, const uint8_t *pathname,
+                        size_t pathnameSize) {
+    // FNV-1a, with the archive key size mixed in so that the split point matters.
+    uint64_t hash = 0xCBF29CE484222325 ^ archiveKeySize;
+    for (size_t i = 0; i < archiveKeySize; ++i) {
+        hash = (hash ^ archiveKey[i]) * 0x100000001B3;
+    }
+    for (size_t i = 0; i < pathnameSize; ++i) {
+        hash = (hash ^ pathname[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+static bool isItemKey(const struct EntryCacheItem *item, uint64_t hash, const uint8_t *archiveKey,
+                      size_t archiveKeySize, const uint8_t *pathname, size_t pathnameSize) {
+    return item->hash == hash && item->archiveKeySize == archiveKeySize
+            && item->keySize == archiveKeySize + pathnameSize
+            && !memcmp(item->key, archiveKey, archiveKeySize)
+            && !memcmp(item->key + archiveKeySize, pathname, pathnameSize);
+}
+
+static void freeItem(struct EntryCacheItem *item) {
+    free(item->key);
+    free(item->data);
+    free(item);
+}
+
+static struct LruList *getItemList(const struct EntryCacheItem *item) {
+    return item->isCompressed ? &gCompressedList : &gContentList;
+}
+
+static void unlinkLru(struct LruList *list, struct EntryCacheItem *item) {
+    if (item->lruPrevious) {
+        item->lruPrevious->lruNext = item->lruNext;
+    } else {
+        list->head = item->lruNext;
+    }
+    if (item->lruNext) {
+        item->lruNext->lruPrevious = item->lruPrevious;
+    } else {
+        list->tail = item->lruPrevious;
+    }
+    item->lruPrevious = NULL;
+    item->lruNext = NULL;
+    list->size -= item->dataSize;
+}
+
+static void linkLruHead(struct LruList *list, struct EntryCacheItem *item) {
+    item->lruPrevious = NULL;
+    item->lruNext = list->head;
+    if (list->head) {
+        list->head->lruPrevious = item;
+    } else {
+        list->tail = item;
+    }
+    list->head = item;
+    list->size += item->dataSize;
+}
+
+// Must be called with the lock.
+static struct EntryCacheItem *findItem(const uint8_t *archiveKey, size_t archiveKeySize,
+                                       const uint8_t *pathname, size_t pathnameSize,
+                                       uint64_t hash) {
+    for (struct EntryCacheItem *item = gBuckets[hash % BUCKET_COUNT]; item;
+            item = item->bucketNext) {
+        if (isItemKey(item, hash, archiveKey, archiveKeySize, pathname, pathnameSize)) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+// Must be called with the lock.
+static void linkItem(struct EntryCacheItem *item) {
+    struct EntryCacheItem **bucket = &gBuckets[item->hash % BUCKET_COUNT];
+    item->bucketNext = *bucket;
+    *bucket = item;
+    linkLruHead(getItemList(item), item);
+}
+
+// Must be called with the lock.
+static void unlinkItem(struct EntryCacheItem *item) {
+    struct EntryCacheItem **link = &gBuckets[item->hash % BUCKET_COUNT];
+    while (*link != item) {
+        link = &(*link)->bucketNext;
+    }
+    *link = item->bucketNext;
+    item->bucketNext = NULL;
+    unlinkLru(getItemList(item), item);
+}
+
+// Must be called with the lock.
+static void removeItem(struct EntryCacheItem *item) {
+    unlinkItem(item);
+    if (item->referenceCount) {
+        item->isRemoved = true;
+    } else {
+        freeItem(item);
+    }
+}
+
+// Compresses an item taken out of the cache, and returns false if it isn't worth keeping.
+static bool compressItem(struct EntryCacheItem *item, size_t compressedMemoryLimit) {
+    if (item->contentSize > LZ4_MAX_INPUT_SIZE) {
+        return false;
+    }
+    int boundSize = LZ4_compressBound((int) item->contentSize);
+    uint8_t *compressedData = malloc((size_t) boundSize);
+    if (!compressedData) {
+        return false;
+    }
+    int compressedSize = LZ4_compress_default((const char *) item->data, (char *) compressedData,
+                                              (int) item->contentSize, boundSize);
+    // Already compressed content, e.g. JPEG pages, rarely shrinks enough to be worth it.
+    if (compressedSize <= 0 || (size_t) compressedSize > item->contentSize / 8 * 7
+            || (size_t) compressedSize > compressedMemoryLimit) {
+        free(compressedData);
+        return false;
+    }
+    uint8_t *shrunkData = realloc(compressedData, (size_t) compressedSize);
+    free(item->data);
+    item->data = shrunkData ? shrunkData : compressedData;
+    item->dataSize = (size_t) compressedSize;
+    item->isCompressed = true;
+    return true;
+}
+
+// Must be called with the lock.
+static void trimCompressedList() {
+    while (gCompressedList.size > gCompressedList.limit) {
+        removeItem(gCompressedList.tail);
+    }
+}
+
+// Must be called with the lock, which is released before compressing the evicted items.
+static void trimListsAndUnlock() {
+    // Evicted items are chained through lruNext while they are out of the cache.
+    struct EntryCacheItem *evictedItems = NULL;
+    while (gContentList.size > gContentList.limit) {
+        struct EntryCacheItem *item = gContentList.tail;
+        if (item->referenceCount || !gCompressedList.limit) {
+            removeItem(item);
+            continue;
+        }
+        unlinkItem(item);
+        item->lruNext = evictedItems;
+        evictedItems = item;
+    }
+    trimCompressedList();
+    if (!evictedItems) {
+        pthread_mutex_unlock(&gEntryCacheMutex);
+        return;
+    }
+    size_t compressedMemoryLimit = gCompressedList.limit;
+    uint64_t invalidationCount = gInvalidationCount;
+    pthread_mutex_unlock(&gEntryCacheMutex);
+    struct EntryCacheItem *compressedItems = NULL;
+    while (evictedItems) {
+        struct EntryCacheItem *item = evictedItems;
+        evictedItems = item->lruNext;
+        if (compressItem(item, compressedMemoryLimit)) {
+            item->lruNext = compressedItems;
+            compressedItems = item;
+        } else {
+            freeItem(item);
+        }
+    }
+    if (!compressedItems) {
+        return;
+    }
+    struct EntryCacheItem *droppedItems = NULL;
+    pthread_mutex_lock(&gEntryCacheMutex);
+    while (compressedItems) {
+        struct EntryCacheItem *item = compressedItems;
+        compressedItems = item->lruNext;
+        // Newer content for the same key wins.
+        if (gInvalidationCount != invalidationCount || findItem(item->key, item->archiveKeySize,
+                item->key + item->archiveKeySize, item->keySize - item->archiveKeySize,
+                item->hash)) {
+            item->lruNext = droppedItems;
+            droppedItems = item;
+            continue;
+        }
+        linkItem(item);
+    }
+    trimCompressedList();
+    pthread_mutex_unlock(&gEntryCacheMutex);
+    while (droppedItems) {
+        struct EntryCacheItem *item = droppedItems;
+        droppedItems = item->lruNext;
+        freeItem(item);
+    }
+}
+
+void entryCacheSetLimits(size_t memoryLimit, size_t compressedMemoryLimit) {
+    pthread_mutex_lock(&gEntryCacheMutex);
+    gContentList.limit = memoryLimit;
+    gCompressedList.limit = compressedMemoryLimit;
+    trimListsAndUnlock();
+}
+
+size_t entryCacheGetMemoryLimit(void) {
+    pthread_mutex_lock(&gEntryCacheMutex);
+    size_t memoryLimit = gContentList.limit;
+    pthread_mutex_unlock(&gEntryCacheMutex);
+    return memoryLimit;
+}
+
+bool entryCachePut(const uint8_t *archiveKey, size_t archiveKeySize, const uint8_t *pathname,
+                   size_t pathnameSize, const uint8_t *content, size_t contentSize) {
+    uint8_t *data = malloc(contentSize ? contentSize : 1);
+    if (!data) {
+        return false;
+    }
+    memcpy(data, content, contentSize);
+    return entryCachePutOwned(archiveKey, archiveKeySize, pathname, pathnameSize, data,
+                              contentSize);
+}
+
+bool entryCachePutOwned(const uint8_t *archiveKey, size_t archiveKeySize, const uint8_t *pathname,
+                        size_t pathnameSize, uint8_t *content, size_t contentSize) {
+    struct EntryCacheItem *item = calloc(1, sizeof(*item));
+    if (!item) {
+        free(content);
+        return false;
+    }
+    // Keep at least a byte, so that empty content still has a valid pointer.
+    item->data = content ? content : malloc(1);
+    item->keySize = archiveKeySize + pathnameSize;
+    item->key = malloc(item->keySize ? item->keySize : 1);
+    if (!item->key || !item->data) {
+        freeItem(item);
+        return false;
+    }
+    memcpy(item->key, archiveKey, archiveKeySize);
+    memcpy(item->key + archiveKeySize, pathname, pathnameSize);
+    item->archiveKeySize = archiveKeySize;
+    item->hash = hashKey(archiveKey, archiveKeySize, pathname, pathnameSize);
+    item->dataSize = contentSize;
+    item->contentSize = contentSize;
+    pthread_mutex_lock(&gEntryCacheMutex);
+    if (!gContentList.limit || contentSize > gContentList.limit) {
+        pthread_mutex_unlock(&gEntryCacheMutex);
+        freeItem(item);
+        return false;
+    }
+    struct EntryCacheItem *oldItem = findItem(archiveKey, archiveKeySize, pathname, pathnameSize,
+                                              item->hash);
+    if (oldItem) {
+        removeItem(oldItem);
+    }
+    linkItem(item);
+    trimListsAndUnlock();
+    return true;
+}
+
+// Decompresses an item with a reference held, and either replaces its data or returns false.
+static bool decompressItem(struct EntryCacheItem *item) {
+    uint8_t *content = malloc(item->contentSize ? item->contentSize : 1);
+    if (content) {
+        int decompressedSize = LZ4_decompress_safe((const char *) item->data, (char *) content,
+                                                   (int) item->dataSize, (int) item->contentSize);
+        if (decompressedSize < 0 || (size_t) decompressedSize != item->contentSize) {
+            free(content);
+            content = NULL;
+        }
+    }
+    pthread_mutex_lock(&gEntryCacheMutex);
+    item->isDecompressing = false;
+    if (!content) {
+        pthread_mutex_unlock(&gEntryCacheMutex);
+        return false;
+    }
+    uint8_t *compressedData = item->data;
+    // The item may have been removed meanwhile, and is then only kept for this reference.
+    if (!item->isRemoved) {
+        unlinkLru(&gCompressedList, item);
+    }
+    item->data = content;
+    item->dataSize = item->contentSize;
+    item->isCompressed = false;
+    if (!item->isRemoved) {
+        linkLruHead(&gContentList, item);
+    }
+    trimListsAndUnlock();
+    free(compressedData);
+    return true;
+}
+
+struct EntryCacheItem *entryCacheAcquire(const uint8_t *archiveKey, size_t archiveKeySize,
+                                         const uint8_t *pathname, size_t pathnameSize) {
+    uint64_t hash = hashKey(archiveKey, archiveKeySize, pathname, pathnameSize);
+    pthread_mutex_lock(&gEntryCacheMutex);
+    struct EntryCacheItem *item = findItem(archiveKey, archiveKeySize, pathname, pathnameSize,
+                                           hash);
+    if (!item || item->isDecompressing) {
+        pthread_mutex_unlock(&gEntryCacheMutex);
+        return NULL;
+    }
+    ++item->referenceCount;
+    if (item->isCompressed) {
+        // Only this thread touches the compressed data until it's replaced.
+        item->isDecompressing = true;
+        pthread_mutex_unlock(&gEntryCacheMutex);
+        if (!decompressItem(item)) {
+            entryCacheRelease(item);
+            return NULL;
+        }
+        return item;
+    }
+    unlinkLru(&gContentList, item);
+    linkLruHead(&gContentList, item);
+    trimListsAndUnlock();
+    return item;
+}
+
+const uint8_t *entryCacheItemGetContent(const struct EntryCacheItem *item) {
+    return item->data;
+}
+
+size_t entryCacheItemGetContentSize(const struct EntryCacheItem *item) {
+    return item->contentSize;
+}
+
+void entryCacheRelease(struct EntryCacheItem *item) {
+    pthread_mutex_lock(&gEntryCacheMutex);
+    --item->referenceCount;
+    bool isFreed = !item->referenceCount && item->isRemoved;
+    pthread_mutex_unlock(&gEntryCacheMutex);
+    if (isFreed) {
+        freeItem(item);
+    }
+}
+
+void entryCacheInvalidate(const uint8_t *archiveKey, size_t archiveKeySize) {
+    pthread_mutex_lock(&gEntryCacheMutex);
+    ++gInvalidationCount;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        struct EntryCacheItem *item = gBuckets[i];
+        while (item) {
+            struct EntryCacheItem *next = item->bucketNext;
+            if (!archiveKey || (item->archiveKeySize == archiveKeySize
+                    && !memcmp(item->key, archiveKey, archiveKeySize))) {
+                removeItem(item);
+            }
+            item = next;
+        }
+    }
+    pthread_mutex_unlock(&gEntryCacheMutex);
+}
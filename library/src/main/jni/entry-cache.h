@@ -0,0 +1,60 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A process-wide LRU cache of decompressed entry content, keyed by an archive key chosen by the app
+// and the entry pathname.
+
+#ifndef LIBARCHIVE_ANDROID_ENTRY_CACHE_H
+#define LIBARCHIVE_ANDROID_ENTRY_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct EntryCacheItem;
+
+// Content is kept as is up to memoryLimit bytes, and content evicted from there is kept compressed
+// with LZ4 up to compressedMemoryLimit bytes. Both are 0 by default, which disables the cache.
+void entryCacheSetLimits(size_t memoryLimit, size_t compressedMemoryLimit);
+
+// Returns the memory limit, which is also the largest content that can be put.
+size_t entryCacheGetMemoryLimit(void);
+
+// Copies the content into the cache, replacing any content for the same key. Returns false if the
+// content doesn't fit or allocation failed.
+bool entryCachePut(const uint8_t *archiveKey, size_t archiveKeySize, const uint8_t *pathname,
+                   size_t pathnameSize, const uint8_t *content, size_t contentSize);
+
+// Like entryCachePut(), but takes ownership of the malloc()ed content instead of copying it. The
+// content is freed if it can't be put.
+bool entryCachePutOwned(const uint8_t *archiveKey, size_t archiveKeySize, const uint8_t *pathname,
+                        size_t pathnameSize, uint8_t *content, size_t contentSize);
+
+// Returns the item for the key with its content decompressed, or NULL. The content stays valid
+// until the item is released, even if it is evicted meanwhile.
+struct EntryCacheItem *entryCacheAcquire(const uint8_t *archiveKey, size_t archiveKeySize,
+                                         const uint8_t *pathname, size_t pathnameSize);
+
+const uint8_t *entryCacheItemGetContent(const struct EntryCacheItem *item);
+
+size_t entryCacheItemGetContentSize(const struct EntryCacheItem *item);
+
+void entryCacheRelease(struct EntryCacheItem *item);
+
+// Removes all content for the archive key, or for all archives if archiveKey is NULL.
+void entryCacheInvalidate(const uint8_t *archiveKey, size_t archiveKeySize);
+
+#endif // LIBARCHIVE_ANDROID_ENTRY_CACHE_H
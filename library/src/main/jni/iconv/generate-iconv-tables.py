@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+#
+# Copyright 2026 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Generates iconv-tables.h from the Python codecs. Usage: generate-iconv-tables.py > iconv-tables.h
+
+import sys
+
+# (Python codec, names), where names are normalized to upper case without '-', '_' and ' '.
+SINGLE_BYTE_CHARSETS = [
+    ('cp437', ['CP437', 'IBM437', '437']),
+    ('cp737', ['CP737', 'IBM737', '737']),
+    ('cp775', ['CP775', 'IBM775', '775']),
+    ('cp850', ['CP850', 'IBM850', '850']),
+    ('cp852', ['CP852', 'IBM852', '852']),
+    ('cp855', ['CP855', 'IBM855', '855']),
+    ('cp857', ['CP857', 'IBM857', '857']),
+    ('cp858', ['CP858', 'IBM858', '858']),
+    ('cp860', ['CP860', 'IBM860', '860']),
+    ('cp861', ['CP861', 'IBM861', '861']),
+    ('cp862', ['CP862', 'IBM862', '862']),
+    ('cp863', ['CP863', 'IBM863', '863']),
+    ('cp865', ['CP865', 'IBM865', '865']),
+    ('cp866', ['CP866', 'IBM866', '866']),
+    ('cp869', ['CP869', 'IBM869', '869']),
+    ('cp874', ['CP874', 'WINDOWS874', 'TIS620']),
+    ('cp1250', ['CP1250', 'WINDOWS1250']),
+    ('cp1251', ['CP1251', 'WINDOWS1251']),
+    ('cp1252', ['CP1252', 'WINDOWS1252']),
+    ('cp1253', ['CP1253', 'WINDOWS1253']),
+    ('cp1254', ['CP1254', 'WINDOWS1254']),
+    ('cp1255', ['CP1255', 'WINDOWS1255']),
+    ('cp1256', ['CP1256', 'WINDOWS1256']),
+    ('cp1257', ['CP1257', 'WINDOWS1257']),
+    ('cp1258', ['CP1258', 'WINDOWS1258']),
+    ('iso8859_1', ['ISO88591', 'LATIN1', 'L1']),
+    ('iso8859_2', ['ISO88592', 'LATIN2', 'L2']),
+    ('iso8859_3', ['ISO88593', 'LATIN3', 'L3']),
+    ('iso8859_4', ['ISO88594', 'LATIN4', 'L4']),
+    ('iso8859_5', ['ISO88595', 'CYRILLIC']),
+    ('iso8859_6', ['ISO88596', 'ARABIC']),
+    ('iso8859_7', ['ISO88597', 'GREEK']),
+    ('iso8859_8', ['ISO88598', 'HEBREW']),
+    ('iso8859_9', ['ISO88599', 'LATIN5', 'L5']),
+    ('iso8859_10', ['ISO885910', 'LATIN6', 'L6']),
+    ('iso8859_11', ['ISO885911']),
+    ('iso8859_13', ['ISO885913', 'LATIN7', 'L7']),
+    ('iso8859_14', ['ISO885914', 'LATIN8', 'L8']),
+    ('iso8859_15', ['ISO885915', 'LATIN9', 'L9']),
+    ('iso8859_16', ['ISO885916', 'LATIN10', 'L10']),
+    ('koi8_r', ['KOI8R']),
+    ('koi8_u', ['KOI8U']),
+]
+
+# (Python codec, names, single byte overrides)
+DOUBLE_BYTE_CHARSETS = [
+    ('cp932', ['CP932', 'MS932', 'WINDOWS31J', 'SJIS', 'SHIFTJIS', 'MSKANJI'], {}),
+    # Python's GBK lacks the euro sign that Windows has at 0x80.
+    ('gbk', ['CP936', 'MS936', 'WINDOWS936', 'GBK', 'GB2312', 'EUCCN'], {0x80: 0x20AC}),
+    ('cp949', ['CP949', 'MS949', 'UHC', 'EUCKR'], {}),
+    ('cp950', ['CP950', 'MS950', 'BIG5'], {}),
+]
+
+
+def decode(codec, data):
+    try:
+        text = data.decode(codec)
+    except UnicodeDecodeError:
+        return 0
+    if len(text) != 1:
+        return 0
+    code_point = ord(text)
+    if code_point > 0xFFFF:
+        raise ValueError(f'{codec} {data.hex()} maps outside the BMP')
+    return code_point
+
+
+def check_ascii_compatible(codec):
+    for byte in range(0x80):
+        if decode(codec, bytes([byte])) != byte and byte != 0:
+            raise ValueError(f'{codec} is not ASCII compatible at {byte:#x}')
+
+
+def format_table(name, values):
+    lines = [f'static const uint16_t {name}[{len(values)}] = {{']
+    for i in range(0, len(values), 12):
+        lines.append('    ' + ', '.join(f'0x{value:04X}' for value in values[i:i + 12]) + ',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def append_optional_table(output, name, values):
+    if not values:
+        return 'NULL'
+    output.append(format_table(name, values))
+    output.append('')
+    return name
+
+
+def main():
+    output = [
+        '// Generated by generate-iconv-tables.py from the Python codecs, do not edit.',
+        '',
+    ]
+    charsets = []
+    for codec, names in SINGLE_BYTE_CHARSETS:
+        check_ascii_compatible(codec)
+        high = [decode(codec, bytes([byte])) for byte in range(0x80, 0x100)]
+        name = names[0] + '_HIGH'
+        output.append(format_table(name, high))
+        output.append('')
+        charsets.append((names, name, 'NULL', 'NULL', 0, 0, 0, 0, 'NULL', 0, 'NULL', 0))
+    for codec, names, overrides in DOUBLE_BYTE_CHARSETS:
+        check_ascii_compatible(codec)
+        high = [decode(codec, bytes([byte])) for byte in range(0x80, 0x100)]
+        for byte, code_point in overrides.items():
+            high[byte - 0x80] = code_point
+        pairs = {}
+        for lead in range(0x81, 0x100):
+            if high[lead - 0x80]:
+                continue
+            for trail in range(0x40, 0x100):
+                code_point = decode(codec, bytes([lead, trail]))
+                if code_point:
+                    pairs[(lead, trail)] = code_point
+        lead_min = min(lead for lead, _ in pairs)
+        lead_max = max(lead for lead, _ in pairs)
+        trail_min = min(trail for _, trail in pairs)
+        trail_max = max(trail for _, trail in pairs)
+        trail_count = trail_max - trail_min + 1
+        # Only rows with any mapping are stored, and the row index maps a lead byte to its row.
+        rows = []
+        double = []
+        for lead in range(lead_min, lead_max + 1):
+            row = [pairs.get((lead, trail), 0) for trail in range(trail_min, trail_max + 1)]
+            if any(row):
+                rows.append(len(double) // trail_count)
+                double.extend(row)
+            else:
+                rows.append(0xFFFF)
+        high_name = names[0] + '_HIGH'
+        rows_name = names[0] + '_ROWS'
+        double_name = names[0] + '_DOUBLE'
+        output.append(format_table(high_name, high))
+        output.append('')
+        output.append(format_table(rows_name, rows))
+        output.append('')
+        output.append(format_table(double_name, double))
+        output.append('')
+        # Codes that decode to a character with another preferred encoding, e.g. the NEC selected
+        # IBM extensions in CP932, must be skipped when encoding.
+        decode_only = []
+        for byte in range(0x80, 0x100):
+            code_point = high[byte - 0x80]
+            if code_point and byte not in overrides and chr(code_point).encode(codec) != bytes(
+                    [byte]):
+                decode_only.append(byte)
+        for (lead, trail), code_point in sorted(pairs.items()):
+            if chr(code_point).encode(codec) != bytes([lead, trail]):
+                decode_only.append((lead << 8) | trail)
+        # Conversely, some characters are encoded one way only, e.g. U+00A2 as the full width
+        # cent sign in CP932.
+        decoded = set(pairs.values()) | set(high)
+        encode_only = []
+        for code_point in range(0x80, 0x10000):
+            if code_point in decoded or 0xD800 <= code_point <= 0xDFFF:
+                continue
+            try:
+                data = chr(code_point).encode(codec)
+            except UnicodeEncodeError:
+                continue
+            encode_only.extend([code_point, int.from_bytes(data, 'big')])
+        decode_only_name = append_optional_table(output, names[0] + '_DECODE_ONLY', decode_only)
+        encode_only_name = append_optional_table(output, names[0] + '_ENCODE_ONLY', encode_only)
+        charsets.append((names, high_name, rows_name, double_name, lead_min, lead_max, trail_min,
+                         trail_max, decode_only_name, len(decode_only), encode_only_name,
+                         len(encode_only) // 2))
+    output.append('static const struct IconvTable ICONV_TABLES[] = {')
+    for (names, high_name, rows_name, double_name, lead_min, lead_max, trail_min, trail_max,
+         decode_only_name, decode_only_count, encode_only_name, encode_only_count) in charsets:
+        # Separate literals, because a name starting with a digit would extend the octal escape.
+        names_literal = ' '.join(f'"{name}\\0"' for name in names)
+        output.append(f'    {{ {names_literal},')
+        output.append(f'      {high_name}, {rows_name}, {double_name}, 0x{lead_min:02X}, '
+                      f'0x{lead_max:02X}, 0x{trail_min:02X}, 0x{trail_max:02X},')
+        output.append(f'      {decode_only_name}, {decode_only_count}, {encode_only_name}, '
+                      f'{encode_only_count} }},')
+    output.append('};')
+    sys.stdout.write('\n'.join(output) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,554 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "iconv.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Legacy codepages are ASCII compatible, and map the bytes 0x80-0xFF through high. Double byte
+// codepages additionally map a lead byte through rows to a row of trail bytes in doubleByte. Zero
+// means unmapped in all tables.
+struct IconvTable {
+    // Normalized names, each terminated by '\0', and the list terminated by an empty name.
+    const char *names;
+    const uint16_t *high;
+    const uint16_t *rows;
+    const uint16_t *doubleByte;
+    uint8_t leadMin;
+    uint8_t leadMax;
+    uint8_t trailMin;
+    uint8_t trailMax;
+    // Sorted codes that are only used for decoding, because their character has another code.
+    const uint16_t *decodeOnly;
+    size_t decodeOnlyLength;
+    // Pairs of a character and its code that are only used for encoding.
+    const uint16_t *encodeOnly;
+    size_t encodeOnlyLength;
+};
+
+#include "iconv-tables.h"
+
+#define ICONV_TABLE_COUNT (sizeof(ICONV_TABLES) / sizeof(*ICONV_TABLES))
+#define ICONV_NO_ROW 0xFFFF
+
+enum IconvEncoding {
+    ICONV_ENCODING_UTF8,
+    ICONV_ENCODING_UTF16BE,
+    ICONV_ENCODING_UTF16LE,
+    ICONV_ENCODING_ASCII,
+    ICONV_ENCODING_TABLE,
+};
+
+struct IconvCharset {
+    enum IconvEncoding encoding;
+    const struct IconvTable *table;
+    size_t tableIndex;
+};
+
+struct IconvEncodeEntry {
+    uint16_t codePoint;
+    uint16_t code;
+};
+
+struct IconvEncodeIndex {
+    struct IconvEncodeEntry *entries;
+    size_t length;
+};
+
+struct Iconv {
+    struct IconvCharset from;
+    struct IconvCharset to;
+    const struct IconvEncodeIndex *toIndex;
+    bool isAsciiCompatible;
+};
+
+static pthread_mutex_t gEncodeIndexesMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct IconvEncodeIndex gEncodeIndexes[ICONV_TABLE_COUNT];
+
+// Upper cases the name and drops '-', '_' and ' ', as well as suffixes like "//TRANSLIT".
+static bool normalizeCharsetName(const char *name, char *normalized, size_t size) {
+    size_t length = 0;
+    for (; *name && *name != '/'; ++name) {
+        char c = *name;
+        if (c == '-' || c == '_' || c == ' ') {
+            continue;
+        }
+        if (length + 1 >= size) {
+            return false;
+        }
+        normalized[length++] = c >= 'a' && c <= 'z' ? (char) (c - 'a' + 'A') : c;
+    }
+    normalized[length] = '\0';
+    return true;
+}
+
+static bool findCharset(const char *name, struct IconvCharset *charset) {
+    char normalized[32];
+    if (!normalizeCharsetName(name, normalized, sizeof(normalized))) {
+        return false;
+    }
+    charset->table = NULL;
+    charset->tableIndex = 0;
+    // The empty name means the locale charset, which is always UTF-8 on Android.
+    if (!strcmp(normalized, "") || !strcmp(normalized, "UTF8")) {
+        charset->encoding = ICONV_ENCODING_UTF8;
+        return true;
+    }
+    if (!strcmp(normalized, "UTF16BE")) {
+        charset->encoding = ICONV_ENCODING_UTF16BE;
+        return true;
+    }
+    if (!strcmp(normalized, "UTF16LE")) {
+        charset->encoding = ICONV_ENCODING_UTF16LE;
+        return true;
+    }
+    if (!strcmp(normalized, "ASCII") || !strcmp(normalized, "USASCII")
+            || !strcmp(normalized, "ANSIX3.41968") || !strcmp(normalized, "646")) {
+        charset->encoding = ICONV_ENCODING_ASCII;
+        return true;
+    }
+    for (size_t i = 0; i < ICONV_TABLE_COUNT; ++i) {
+        for (const char *tableName = ICONV_TABLES[i].names; *tableName;
+                tableName += strlen(tableName) + 1) {
+            if (!strcmp(normalized, tableName)) {
+                charset->encoding = ICONV_ENCODING_TABLE;
+                charset->table = &ICONV_TABLES[i];
+                charset->tableIndex = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int compareEncodeEntries(const void *left, const void *right) {
+    const struct IconvEncodeEntry *leftEntry = left;
+    const struct IconvEncodeEntry *rightEntry = right;
+    if (leftEntry->codePoint != rightEntry->codePoint) {
+        return leftEntry->codePoint < rightEntry->codePoint ? -1 : 1;
+    }
+    return leftEntry->code < rightEntry->code ? -1 : leftEntry->code > rightEntry->code ? 1 : 0;
+}
+
+static int compareCodes(const void *left, const void *right) {
+    uint16_t leftCode = *(const uint16_t *) left;
+    uint16_t rightCode = *(const uint16_t *) right;
+    return leftCode < rightCode ? -1 : leftCode > rightCode ? 1 : 0;
+}
+
+static bool isDecodeOnly(const struct IconvTable *table, uint16_t code) {
+    return table->decodeOnly && bsearch(&code, table->decodeOnly, table->decodeOnlyLength,
+            sizeof(*table->decodeOnly), compareCodes);
+}
+
+static bool addEncodeEntry(const struct IconvTable *table, struct IconvEncodeIndex *index,
+                           size_t *capacity, uint16_t codePoint, uint16_t code) {
+    if (!codePoint || isDecodeOnly(table, code)) {
+        return true;
+    }
+    if (index->length == *capacity) {
+        size_t newCapacity = *capacity ? *capacity * 2 : 128;
+        struct IconvEncodeEntry *newEntries = realloc(index->entries,
+                newCapacity * sizeof(*newEntries));
+        if (!newEntries) {
+            return false;
+        }
+        index->entries = newEntries;
+        *capacity = newCapacity;
+    }
+    struct IconvEncodeEntry *entry = &index->entries[index->length++];
+    entry->codePoint = codePoint;
+    entry->code = code;
+    return true;
+}
+
+// The reverse mapping is only needed for writing, so it's built on first use and kept for the
+// lifetime of the process.
+static const struct IconvEncodeIndex *getEncodeIndex(const struct IconvCharset *charset) {
+    pthread_mutex_lock(&gEncodeIndexesMutex);
+    struct IconvEncodeIndex *index = &gEncodeIndexes[charset->tableIndex];
+    if (index->entries) {
+        pthread_mutex_unlock(&gEncodeIndexesMutex);
+        return index;
+    }
+    const struct IconvTable *table = charset->table;
+    size_t capacity = 0;
+    bool successful = true;
+    for (int byte = 0x80; byte <= 0xFF && successful; ++byte) {
+        successful = addEncodeEntry(table, index, &capacity, table->high[byte - 0x80],
+                (uint16_t) byte);
+    }
+    if (table->doubleByte) {
+        size_t trailCount = table->trailMax - table->trailMin + 1;
+        for (int lead = table->leadMin; lead <= table->leadMax && successful; ++lead) {
+            uint16_t row = table->rows[lead - table->leadMin];
+            if (row == ICONV_NO_ROW) {
+                continue;
+            }
+            const uint16_t *codePoints = table->doubleByte + row * trailCount;
+            for (size_t i = 0; i < trailCount && successful; ++i) {
+                successful = addEncodeEntry(table, index, &capacity, codePoints[i],
+                        (uint16_t) ((lead << 8) | (table->trailMin + i)));
+            }
+        }
+    }
+    for (size_t i = 0; i < table->encodeOnlyLength && successful; ++i) {
+        successful = addEncodeEntry(table, index, &capacity, table->encodeOnly[2 * i],
+                table->encodeOnly[2 * i + 1]);
+    }
+    if (!successful) {
+        free(index->entries);
+        index->entries = NULL;
+        index->length = 0;
+        pthread_mutex_unlock(&gEncodeIndexesMutex);
+        return NULL;
+    }
+    qsort(index->entries, index->length, sizeof(*index->entries), compareEncodeEntries);
+    pthread_mutex_unlock(&gEncodeIndexesMutex);
+    return index;
+}
+
+iconv_t iconv_open(const char *tocode, const char *fromcode) {
+    struct IconvCharset from;
+    struct IconvCharset to;
+    if (!findCharset(fromcode, &from) || !findCharset(tocode, &to)) {
+        errno = EINVAL;
+        return (iconv_t) -1;
+    }
+    const struct IconvEncodeIndex *toIndex = NULL;
+    if (to.encoding == ICONV_ENCODING_TABLE) {
+        toIndex = getEncodeIndex(&to);
+        if (!toIndex) {
+            errno = ENOMEM;
+            return (iconv_t) -1;
+        }
+    }
+    struct Iconv *converter = malloc(sizeof(*converter));
+    if (!converter) {
+        errno = ENOMEM;
+        return (iconv_t) -1;
+    }
+    converter->from = from;
+    converter->to = to;
+    converter->toIndex = toIndex;
+    converter->isAsciiCompatible = from.encoding != ICONV_ENCODING_UTF16BE
+            && from.encoding != ICONV_ENCODING_UTF16LE && to.encoding != ICONV_ENCODING_UTF16BE
+            && to.encoding != ICONV_ENCODING_UTF16LE;
+    return converter;
+}
+
+// Returns the number of bytes consumed, 0 if the input ends in the middle of a character, or -1 if
+// the input is invalid.
+static int decodeCharacter(const struct IconvCharset *charset, const uint8_t *in, size_t inLength,
+                           uint32_t *codePoint) {
+    switch (charset->encoding) {
+        case ICONV_ENCODING_UTF8: {
+            uint32_t value = in[0];
+            if (value < 0x80) {
+                *codePoint = value;
+                return 1;
+            }
+            int length;
+            uint32_t minValue;
+            if ((value & 0xE0) == 0xC0) {
+                length = 2;
+                value &= 0x1F;
+                minValue = 0x80;
+            } else if ((value & 0xF0) == 0xE0) {
+                length = 3;
+                value &= 0x0F;
+                minValue = 0x800;
+            } else if ((value & 0xF8) == 0xF0) {
+                length = 4;
+                value &= 0x07;
+                minValue = 0x10000;
+            } else {
+                return -1;
+            }
+            for (int i = 1; i < length; ++i) {
+                if ((size_t) i >= inLength) {
+                    return 0;
+                }
+                if ((in[i] & 0xC0) != 0x80) {
+                    return -1;
+                }
+                value = (value << 6) | (in[i] & 0x3F);
+            }
+            if (value < minValue || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+                return -1;
+            }
+            *codePoint = value;
+            return length;
+        }
+        case ICONV_ENCODING_UTF16BE:
+        case ICONV_ENCODING_UTF16LE: {
+            bool isBigEndian = charset->encoding == ICONV_ENCODING_UTF16BE;
+            if (inLength < 2) {
+                return 0;
+            }
+            uint32_t unit = isBigEndian ? (in[0] << 8) | in[1] : (in[1] << 8) | in[0];
+            if (unit < 0xD800 || unit > 0xDFFF) {
+                *codePoint = unit;
+                return 2;
+            }
+            if (unit > 0xDBFF) {
+                return -1;
+            }
+            if (inLength < 4) {
+                return 0;
+            }
+            uint32_t lowUnit = isBigEndian ? (in[2] << 8) | in[3] : (in[3] << 8) | in[2];
+            if (lowUnit < 0xDC00 || lowUnit > 0xDFFF) {
+                return -1;
+            }
+            *codePoint = 0x10000 + ((unit - 0xD800) << 10) + (lowUnit - 0xDC00);
+            return 4;
+        }
+        case ICONV_ENCODING_ASCII:
+            if (in[0] >= 0x80) {
+                return -1;
+            }
+            *codePoint = in[0];
+            return 1;
+        case ICONV_ENCODING_TABLE: {
+            const struct IconvTable *table = charset->table;
+            uint8_t lead = in[0];
+            if (lead < 0x80) {
+                *codePoint = lead;
+                return 1;
+            }
+            uint16_t value = table->high[lead - 0x80];
+            if (value) {
+                *codePoint = value;
+                return 1;
+            }
+            if (!table->doubleByte || lead < table->leadMin || lead > table->leadMax
+                    || table->rows[lead - table->leadMin] == ICONV_NO_ROW) {
+                return -1;
+            }
+            if (inLength < 2) {
+                return 0;
+            }
+            uint8_t trail = in[1];
+            if (trail < table->trailMin || trail > table->trailMax) {
+                return -1;
+            }
+            size_t trailCount = table->trailMax - table->trailMin + 1;
+            value = table->doubleByte[table->rows[lead - table->leadMin] * trailCount
+                    + (trail - table->trailMin)];
+            if (!value) {
+                return -1;
+            }
+            *codePoint = value;
+            return 2;
+        }
+    }
+    return -1;
+}
+
+static const struct IconvEncodeEntry *findEncodeEntry(const struct IconvEncodeIndex *index,
+                                                      uint32_t codePoint) {
+    size_t low = 0;
+    size_t high = index->length;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->entries[middle].codePoint < codePoint) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < index->length && index->entries[low].codePoint == codePoint) {
+        return &index->entries[low];
+    }
+    return NULL;
+}
+
+// Returns the number of bytes produced, 0 if the output is too small, or -1 if the character
+// can't be represented.
+static int encodeCharacter(const struct Iconv *converter, uint32_t codePoint, uint8_t *out,
+                           size_t outLength) {
+    switch (converter->to.encoding) {
+        case ICONV_ENCODING_UTF8:
+            if (codePoint < 0x80) {
+                if (outLength < 1) {
+                    return 0;
+                }
+                out[0] = (uint8_t) codePoint;
+                return 1;
+            } else if (codePoint < 0x800) {
+                if (outLength < 2) {
+                    return 0;
+                }
+                out[0] = (uint8_t) (0xC0 | (codePoint >> 6));
+                out[1] = (uint8_t) (0x80 | (codePoint & 0x3F));
+                return 2;
+            } else if (codePoint < 0x10000) {
+                if (outLength < 3) {
+                    return 0;
+                }
+                out[0] = (uint8_t) (0xE0 | (codePoint >> 12));
+                out[1] = (uint8_t) (0x80 | ((codePoint >> 6) & 0x3F));
+                out[2] = (uint8_t) (0x80 | (codePoint & 0x3F));
+                return 3;
+            } else {
+                if (outLength < 4) {
+                    return 0;
+                }
+                out[0] = (uint8_t) (0xF0 | (codePoint >> 18));
+                out[1] = (uint8_t) (0x80 | ((codePoint >> 12) & 0x3F));
+                out[2] = (uint8_t) (0x80 | ((codePoint >> 6) & 0x3F));
+                out[3] = (uint8_t) (0x80 | (codePoint & 0x3F));
+                return 4;
+            }
+        case ICONV_ENCODING_UTF16BE:
+        case ICONV_ENCODING_UTF16LE: {
+            uint16_t units[2];
+            int unitCount;
+            if (codePoint < 0x10000) {
+                units[0] = (uint16_t) codePoint;
+                unitCount = 1;
+            } else {
+                codePoint -= 0x10000;
+                units[0] = (uint16_t) (0xD800 | (codePoint >> 10));
+                units[1] = (uint16_t) (0xDC00 | (codePoint & 0x3FF));
+                unitCount = 2;
+            }
+            if (outLength < (size_t) unitCount * 2) {
+                return 0;
+            }
+            bool isBigEndian = converter->to.encoding == ICONV_ENCODING_UTF16BE;
+            for (int i = 0; i < unitCount; ++i) {
+                out[2 * i] = (uint8_t) (isBigEndian ? units[i] >> 8 : units[i]);
+                out[2 * i + 1] = (uint8_t) (isBigEndian ? units[i] : units[i] >> 8);
+            }
+            return unitCount * 2;
+        }
+        case ICONV_ENCODING_ASCII:
+            if (codePoint >= 0x80) {
+                return -1;
+            }
+            if (outLength < 1) {
+                return 0;
+            }
+            out[0] = (uint8_t) codePoint;
+            return 1;
+        case ICONV_ENCODING_TABLE: {
+            uint16_t code;
+            if (codePoint < 0x80) {
+                code = (uint16_t) codePoint;
+            } else {
+                const struct IconvEncodeEntry *entry = findEncodeEntry(converter->toIndex,
+                        codePoint);
+                if (!entry) {
+                    return -1;
+                }
+                code = entry->code;
+            }
+            if (code <= 0xFF) {
+                if (outLength < 1) {
+                    return 0;
+                }
+                out[0] = (uint8_t) code;
+                return 1;
+            }
+            if (outLength < 2) {
+                return 0;
+            }
+            out[0] = (uint8_t) (code >> 8);
+            out[1] = (uint8_t) code;
+            return 2;
+        }
+    }
+    return -1;
+}
+
+static size_t getAsciiPrefixLength(const uint8_t *bytes, size_t length) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        if (word & 0x8080808080808080) {
+            break;
+        }
+    }
+    while (i < length && bytes[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+size_t iconv(iconv_t cd, char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) {
+    // All supported conversions are stateless, so there's nothing to reset or flush.
+    if (!inbuf || !*inbuf) {
+        return 0;
+    }
+    const struct Iconv *converter = cd;
+    const uint8_t *in = (const uint8_t *) *inbuf;
+    size_t inLength = *inbytesleft;
+    uint8_t *out = (uint8_t *) *outbuf;
+    size_t outLength = *outbytesleft;
+    int error = 0;
+    while (inLength) {
+        if (converter->isAsciiCompatible) {
+            // File names are mostly ASCII, which maps to itself in all ASCII compatible charsets.
+            size_t asciiLength = getAsciiPrefixLength(in, inLength < outLength ? inLength
+                    : outLength);
+            memcpy(out, in, asciiLength);
+            in += asciiLength;
+            inLength -= asciiLength;
+            out += asciiLength;
+            outLength -= asciiLength;
+            if (!inLength) {
+                break;
+            }
+        }
+        uint32_t codePoint;
+        int inSize = decodeCharacter(&converter->from, in, inLength, &codePoint);
+        if (inSize <= 0) {
+            error = inSize ? EILSEQ : EINVAL;
+            break;
+        }
+        int outSize = encodeCharacter(converter, codePoint, out, outLength);
+        if (outSize <= 0) {
+            error = outSize ? EILSEQ : E2BIG;
+            break;
+        }
+        in += inSize;
+        inLength -= inSize;
+        out += outSize;
+        outLength -= outSize;
+    }
+    *inbuf = (char *) in;
+    *inbytesleft = inLength;
+    *outbuf = (char *) out;
+    *outbytesleft = outLength;
+    if (error) {
+        errno = error;
+        return (size_t) -1;
+    }
+    return 0;
+}
+
+int iconv_close(iconv_t cd) {
+    free(cd);
+    return 0;
+}
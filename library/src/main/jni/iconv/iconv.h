@@ -0,0 +1,43 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A minimal built-in iconv for libarchive, because bionic only has iconv since API 28. This header
+// shadows the one in the NDK sysroot, and the functions are renamed so that they never interpose
+// the ones in libc.
+//
+// Supported charsets are UTF-8, UTF-16BE/LE, ASCII and the table-driven legacy codepages in
+// iconv-tables.h. Conversion is stateless, and unmappable characters fail with EILSEQ as in glibc.
+
+#ifndef LIBARCHIVE_ANDROID_ICONV_H
+#define LIBARCHIVE_ANDROID_ICONV_H
+
+#include <stddef.h>
+
+// libarchive's config.h is configured with @ONLY, so ICONV_CONST is never substituted there.
+#undef ICONV_CONST
+#define ICONV_CONST
+
+typedef void *iconv_t;
+
+#define iconv_open archive_android_iconv_open
+#define iconv archive_android_iconv
+#define iconv_close archive_android_iconv_close
+
+iconv_t iconv_open(const char *tocode, const char *fromcode);
+size_t iconv(iconv_t cd, char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft);
+int iconv_close(iconv_t cd);
+
+#endif // LIBARCHIVE_ANDROID_ICONV_H
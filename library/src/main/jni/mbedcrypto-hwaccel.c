@@ -0,0 +1,377 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Hardware accelerated AES block encryption and SHA-1/SHA-256 compression for mbedcrypto, which
+// only has AES-NI on x86_64 and plain C everywhere else. These functions are hooked with the
+// linker's --wrap so that mbedcrypto itself doesn't need to be patched, and they fall back to the
+// original implementation when the CPU doesn't have the instructions.
+//
+// On arm64 this file is compiled with -march=armv8-a+crypto, which is safe because the Crypto
+// Extensions instructions are only ever reached after the HWCAP check.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mbedtls/aes.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/sha256.h>
+
+#include "cpu-features.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_ARMV8_CRYPTO 1
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SHA 1
+#define TARGET_X86_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+
+int __real_mbedtls_aes_crypt_ecb(mbedtls_aes_context *ctx, int mode, const unsigned char input[16],
+                                 unsigned char output[16]);
+int __real_mbedtls_sha1_update_ret(mbedtls_sha1_context *ctx, const unsigned char *input,
+                                   size_t ilen);
+int __real_mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input,
+                                     size_t ilen);
+int __real_mbedtls_sha1_finish_ret(mbedtls_sha1_context *ctx, unsigned char output[20]);
+int __real_mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32]);
+
+#if defined(HAVE_ARMV8_CRYPTO) || defined(HAVE_X86_SHA)
+
+static const uint32_t SHA256_K[] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#endif
+
+#if defined(HAVE_ARMV8_CRYPTO)
+
+static const uint32_t SHA1_K[] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+
+static void aesCryptEcbArmv8(const mbedtls_aes_context *ctx, int mode,
+                             const unsigned char input[16], unsigned char output[16]) {
+    // mbedtls stores the decryption key schedule in the form of the equivalent inverse cipher,
+    // which is exactly what AESD and AESIMC expect.
+    const uint8_t *roundKey = (const uint8_t *) ctx->rk;
+    uint8x16_t block = vld1q_u8(input);
+    if (mode == MBEDTLS_AES_ENCRYPT) {
+        for (int i = 0; i < ctx->nr - 1; ++i, roundKey += 16) {
+            block = vaesmcq_u8(vaeseq_u8(block, vld1q_u8(roundKey)));
+        }
+        block = vaeseq_u8(block, vld1q_u8(roundKey));
+    } else {
+        for (int i = 0; i < ctx->nr - 1; ++i, roundKey += 16) {
+            block = vaesimcq_u8(vaesdq_u8(block, vld1q_u8(roundKey)));
+        }
+        block = vaesdq_u8(block, vld1q_u8(roundKey));
+    }
+    roundKey += 16;
+    vst1q_u8(output, veorq_u8(block, vld1q_u8(roundKey)));
+}
+
+static void sha1ProcessArmv8(uint32_t state[5], const unsigned char *data, size_t blockCount) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e = state[4];
+    for (; blockCount; --blockCount, data += 64) {
+        uint32x4_t savedAbcd = abcd;
+        uint32_t savedE = e;
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+        for (int i = 0; i < 20; ++i) {
+            if (i >= 4) {
+                w[i % 4] = vsha1su1q_u32(vsha1su0q_u32(w[i % 4], w[(i + 1) % 4], w[(i + 2) % 4]),
+                                         w[(i + 3) % 4]);
+            }
+            uint32x4_t wk = vaddq_u32(w[i % 4], vdupq_n_u32(SHA1_K[i / 5]));
+            uint32_t nextE = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (i < 5) {
+                abcd = vsha1cq_u32(abcd, e, wk);
+            } else if (i >= 10 && i < 15) {
+                abcd = vsha1mq_u32(abcd, e, wk);
+            } else {
+                abcd = vsha1pq_u32(abcd, e, wk);
+            }
+            e = nextE;
+        }
+        abcd = vaddq_u32(abcd, savedAbcd);
+        e += savedE;
+    }
+    vst1q_u32(state, abcd);
+    state[4] = e;
+}
+
+static void sha256ProcessArmv8(uint32_t state[8], const unsigned char *data, size_t blockCount) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32x4_t efgh = vld1q_u32(state + 4);
+    for (; blockCount; --blockCount, data += 64) {
+        uint32x4_t savedAbcd = abcd;
+        uint32x4_t savedEfgh = efgh;
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+        for (int i = 0; i < 16; ++i) {
+            if (i >= 4) {
+                w[i % 4] = vsha256su1q_u32(vsha256su0q_u32(w[i % 4], w[(i + 1) % 4]),
+                                           w[(i + 2) % 4], w[(i + 3) % 4]);
+            }
+            uint32x4_t wk = vaddq_u32(w[i % 4], vld1q_u32(SHA256_K + 4 * i));
+            uint32x4_t previousAbcd = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, wk);
+            efgh = vsha256h2q_u32(efgh, previousAbcd, wk);
+        }
+        abcd = vaddq_u32(abcd, savedAbcd);
+        efgh = vaddq_u32(efgh, savedEfgh);
+    }
+    vst1q_u32(state, abcd);
+    vst1q_u32(state + 4, efgh);
+}
+
+#endif // HAVE_ARMV8_CRYPTO
+
+#if defined(HAVE_X86_SHA)
+
+TARGET_X86_SHA
+static void sha1ProcessX86(uint32_t state[5], const unsigned char *data, size_t blockCount) {
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0001020304050607LL, 0x08090A0B0C0D0E0FLL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    __m128i e = _mm_set_epi32((int) state[4], 0, 0, 0);
+    for (; blockCount; --blockCount, data += 64) {
+        __m128i savedAbcd = abcd;
+        __m128i savedE = e;
+        __m128i w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)),
+                                    byteSwapMask);
+        }
+        // SHA1NEXTE derives E for the next four rounds from A of the four rounds before.
+        __m128i previousAbcd = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, _mm_add_epi32(e, w[0]), 0);
+        for (int i = 1; i < 20; ++i) {
+            if (i >= 4) {
+                __m128i next = _mm_xor_si128(_mm_sha1msg1_epu32(w[i % 4], w[(i + 1) % 4]),
+                                             w[(i + 2) % 4]);
+                w[i % 4] = _mm_sha1msg2_epu32(next, w[(i + 3) % 4]);
+            }
+            e = _mm_sha1nexte_epu32(previousAbcd, w[i % 4]);
+            previousAbcd = abcd;
+            // The round function selector has to be an immediate.
+            switch (i / 5) {
+                case 0:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+                    break;
+                case 1:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+                    break;
+                case 2:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+                    break;
+                default:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+            }
+        }
+        e = _mm_sha1nexte_epu32(previousAbcd, savedE);
+        abcd = _mm_add_epi32(abcd, savedAbcd);
+    }
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t) _mm_extract_epi32(e, 3);
+}
+
+TARGET_X86_SHA
+static void sha256ProcessX86(uint32_t state[8], const unsigned char *data, size_t blockCount) {
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0C0D0E0F08090A0BLL, 0x0405060700010203LL);
+    // SHA256RNDS2 keeps the state as ABEF and CDGH.
+    __m128i cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (state + 4)), 0x1B);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+    for (; blockCount; --blockCount, data += 64) {
+        __m128i savedAbef = abef;
+        __m128i savedCdgh = cdgh;
+        __m128i w[4];
+        for (int i = 0; i < 4; ++i) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)),
+                                    byteSwapMask);
+        }
+        for (int i = 0; i < 16; ++i) {
+            if (i >= 4) {
+                __m128i next = _mm_add_epi32(_mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]),
+                                             _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(next, w[(i + 3) % 4]);
+            }
+            __m128i wk = _mm_add_epi32(w[i % 4],
+                                       _mm_loadu_si128((const __m128i *) (SHA256_K + 4 * i)));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+        }
+        abef = _mm_add_epi32(abef, savedAbef);
+        cdgh = _mm_add_epi32(cdgh, savedCdgh);
+    }
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *) state, _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#endif // HAVE_X86_SHA
+
+static void putBigEndian32(unsigned char *bytes, uint32_t value) {
+    bytes[0] = (unsigned char) (value >> 24);
+    bytes[1] = (unsigned char) (value >> 16);
+    bytes[2] = (unsigned char) (value >> 8);
+    bytes[3] = (unsigned char) value;
+}
+
+typedef void (*ShaProcessFunction)(uint32_t *state, const unsigned char *data, size_t blockCount);
+
+// Mirrors the buffering in mbedtls_sha1_update_ret() and mbedtls_sha256_update_ret(), whose
+// contexts share the same layout for total, state and buffer.
+static void shaUpdate(uint32_t total[2], uint32_t *state, unsigned char buffer[64],
+                      const unsigned char *input, size_t ilen, ShaProcessFunction process) {
+    size_t left = total[0] & 0x3F;
+    size_t fill = 64 - left;
+    total[0] += (uint32_t) ilen;
+    if (total[0] < (uint32_t) ilen) {
+        ++total[1];
+    }
+    if (left && ilen >= fill) {
+        memcpy(buffer + left, input, fill);
+        process(state, buffer, 1);
+        input += fill;
+        ilen -= fill;
+        left = 0;
+    }
+    size_t blockCount = ilen / 64;
+    if (blockCount) {
+        process(state, input, blockCount);
+        input += blockCount * 64;
+        ilen -= blockCount * 64;
+    }
+    if (ilen) {
+        memcpy(buffer + left, input, ilen);
+    }
+}
+
+// Mirrors the padding in mbedtls_sha1_finish_ret() and mbedtls_sha256_finish_ret(), which would
+// otherwise compress the last blocks in plain C, because calls within mbedcrypto aren't wrapped.
+static void shaFinish(uint32_t total[2], uint32_t *state, unsigned char buffer[64],
+                      ShaProcessFunction process) {
+    size_t used = total[0] & 0x3F;
+    buffer[used++] = 0x80;
+    if (used > 56) {
+        memset(buffer + used, 0, 64 - used);
+        process(state, buffer, 1);
+        used = 0;
+    }
+    memset(buffer + used, 0, 56 - used);
+    uint32_t high = (total[0] >> 29) | (total[1] << 3);
+    uint32_t low = total[0] << 3;
+    putBigEndian32(buffer + 56, high);
+    putBigEndian32(buffer + 60, low);
+    process(state, buffer, 1);
+}
+
+static ShaProcessFunction getSha1ProcessFunction(void) {
+#if defined(HAVE_ARMV8_CRYPTO)
+    if (hasCpuFeatures(CPU_FEATURE_SHA1)) {
+        return sha1ProcessArmv8;
+    }
+#elif defined(HAVE_X86_SHA)
+    if (hasCpuFeatures(CPU_FEATURE_SHA1)) {
+        return sha1ProcessX86;
+    }
+#endif
+    return NULL;
+}
+
+static ShaProcessFunction getSha256ProcessFunction(void) {
+#if defined(HAVE_ARMV8_CRYPTO)
+    if (hasCpuFeatures(CPU_FEATURE_SHA2)) {
+        return sha256ProcessArmv8;
+    }
+#elif defined(HAVE_X86_SHA)
+    if (hasCpuFeatures(CPU_FEATURE_SHA2)) {
+        return sha256ProcessX86;
+    }
+#endif
+    return NULL;
+}
+
+int __wrap_mbedtls_aes_crypt_ecb(mbedtls_aes_context *ctx, int mode, const unsigned char input[16],
+                                 unsigned char output[16]) {
+#if defined(HAVE_ARMV8_CRYPTO)
+    if ((mode == MBEDTLS_AES_ENCRYPT || mode == MBEDTLS_AES_DECRYPT)
+            && hasCpuFeatures(CPU_FEATURE_AES)) {
+        aesCryptEcbArmv8(ctx, mode, input, output);
+        return 0;
+    }
+#endif
+    return __real_mbedtls_aes_crypt_ecb(ctx, mode, input, output);
+}
+
+int __wrap_mbedtls_sha1_update_ret(mbedtls_sha1_context *ctx, const unsigned char *input,
+                                   size_t ilen) {
+    ShaProcessFunction process = getSha1ProcessFunction();
+    if (!process || !ilen) {
+        return __real_mbedtls_sha1_update_ret(ctx, input, ilen);
+    }
+    shaUpdate(ctx->total, ctx->state, ctx->buffer, input, ilen, process);
+    return 0;
+}
+
+int __wrap_mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input,
+                                     size_t ilen) {
+    ShaProcessFunction process = getSha256ProcessFunction();
+    if (!process || !ilen) {
+        return __real_mbedtls_sha256_update_ret(ctx, input, ilen);
+    }
+    shaUpdate(ctx->total, ctx->state, ctx->buffer, input, ilen, process);
+    return 0;
+}
+
+int __wrap_mbedtls_sha1_finish_ret(mbedtls_sha1_context *ctx, unsigned char output[20]) {
+    ShaProcessFunction process = getSha1ProcessFunction();
+    if (!process) {
+        return __real_mbedtls_sha1_finish_ret(ctx, output);
+    }
+    shaFinish(ctx->total, ctx->state, ctx->buffer, process);
+    for (int i = 0; i < 5; ++i) {
+        putBigEndian32(output + 4 * i, ctx->state[i]);
+    }
+    return 0;
+}
+
+int __wrap_mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32]) {
+    ShaProcessFunction process = getSha256ProcessFunction();
+    if (!process) {
+        return __real_mbedtls_sha256_finish_ret(ctx, output);
+    }
+    shaFinish(ctx->total, ctx->state, ctx->buffer, process);
+    int stateSize = ctx->is224 ? 7 : 8;
+    for (int i = 0; i < stateSize; ++i) {
+        putBigEndian32(output + 4 * i, ctx->state[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Memory-backed temporary files for libarchive, hooked in with the linker's --wrap.
+//
+// The 7z, ISO9660 and xar writers stage all file data in a temporary file from __archive_mktemp()
+// before emitting the archive, which doubles the writes to flash. Temporary files are created with
+// memfd_create() instead, and a write that would take all of them together beyond the limit first
+// copies the file to a real temporary file, which then replaces the memfd under the same
+// descriptor with dup3(), so libarchive keeps using its descriptor and offset as if nothing
+// happened. Only write() grows the file in these writers, so only it and close() need to be hooked.
+//
+// Every write() in the process goes through the hook, so memfds are looked up in a small table of
+// atomics without any lock. A temporary file is only written by the thread of its archive, so
+// spilling it needs no lock either.
+//
+// The temporary file of a 7z archive that is written to a seekable file lives in that file instead,
+// see output-temp-file.c, which shares these hooks.
+
+// For dup3().
+#define _GNU_SOURCE
+
+#include "memory-temp-file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "output-temp-file.h"
+
+#define DEFAULT_MEMORY_TEMP_FILE_LIMIT (32 * 1024 * 1024)
+#define MAX_MEMORY_TEMP_FILE_COUNT 16
+
+int __real___archive_mktemp(const char *tmpdir);
+ssize_t __real_write(int fd, const void *buffer, size_t count);
+int __real_close(int fd);
+
+struct MemoryTempFile {
+    // The descriptor plus one, so that a zeroed slot is free.
+    atomic_int fdPlusOne;
+    atomic_size_t size;
+};
+
+static atomic_size_t gMemoryTempFileLimit = DEFAULT_MEMORY_TEMP_FILE_LIMIT;
+
+static struct MemoryTempFile gMemoryTempFiles[MAX_MEMORY_TEMP_FILE_COUNT];
+// Keeps write() and close() to a single load when there are no memory temp files.
+static atomic_size_t gMemoryTempFileCount = 0;
+// The total size of all memory temp files, which the limit applies to.
+static atomic_size_t gMemoryTempFilesSize = 0;
+
+void setMemoryTempFileLimit(size_t limit) {
+    atomic_store(&gMemoryTempFileLimit, limit);
+}
+
+static struct MemoryTempFile *findMemoryTempFile(int fd) {
+    for (size_t i = 0; i < MAX_MEMORY_TEMP_FILE_COUNT; ++i) {
+        struct MemoryTempFile *file = &gMemoryTempFiles[i];
+        if (atomic_load(&file->fdPlusOne) == fd + 1) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static bool addMemoryTempFile(int fd) {
+    for (size_t i = 0; i < MAX_MEMORY_TEMP_FILE_COUNT; ++i) {
+        struct MemoryTempFile *file = &gMemoryTempFiles[i];
+        int freeFdPlusOne = 0;
+        // The new descriptor isn't written to before it's returned.
+        if (atomic_compare_exchange_strong(&file->fdPlusOne, &freeFdPlusOne, fd + 1)) {
+            atomic_store(&file->size, 0);
+            atomic_fetch_add(&gMemoryTempFileCount, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void removeMemoryTempFile(struct MemoryTempFile *file) {
+    atomic_fetch_sub(&gMemoryTempFilesSize, atomic_load(&file->size));
+    atomic_store(&file->fdPlusOne, 0);
+    atomic_fetch_sub(&gMemoryTempFileCount, 1);
+}
+
+int __wrap___archive_mktemp(const char *tmpdir) {
+    int outputTempFd = createOutputTempFile();
+    if (outputTempFd != -1) {
+        return outputTempFd;
+    }
+    if (!atomic_load(&gMemoryTempFileLimit)
+            || atomic_load(&gMemoryTempFileCount) >= MAX_MEMORY_TEMP_FILE_COUNT) {
+        return __real___archive_mktemp(tmpdir);
+    }
+    // The libc wrapper is only available since API 30.
+    int fd = (int) syscall(__NR_memfd_create, "libarchive-temp", MFD_CLOEXEC);
+    if (fd == -1) {
+        return __real___archive_mktemp(tmpdir);
+    }
+    if (!addMemoryTempFile(fd)) {
+        __real_close(fd);
+        return __real___archive_mktemp(tmpdir);
+    }
+    return fd;
+}
+
+// Moves the content of a memory temp file to a real temporary file under the same descriptor.
+static bool spillMemoryTempFile(int fd) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    struct stat status;
+    if (offset == -1 || fstat(fd, &status)) {
+        return false;
+    }
+    int fileFd = __real___archive_mktemp(NULL);
+    if (fileFd == -1) {
+        return false;
+    }
+    off_t copyOffset = 0;
+    while (copyOffset < status.st_size) {
+        ssize_t copiedSize = sendfile(fileFd, fd, &copyOffset,
+                                      (size_t) (status.st_size - copyOffset));
+        if (copiedSize <= 0) {
+            if (copiedSize == -1 && errno == EINTR) {
+                continue;
+            }
+            __real_close(fileFd);
+            return false;
+        }
+    }
+    if (lseek(fileFd, offset, SEEK_SET) == -1 || dup3(fileFd, fd, O_CLOEXEC) == -1) {
+        __real_close(fileFd);
+        return false;
+    }
+    __real_close(fileFd);
+    return true;
+}
+
+ssize_t __wrap_write(int fd, const void *buffer, size_t count) {
+    ssize_t result;
+    if (writeOutputTempFile(fd, buffer, count, &result)) {
+        return result;
+    }
+    if (!atomic_load_explicit(&gMemoryTempFileCount, memory_order_relaxed)) {
+        return __real_write(fd, buffer, count);
+    }
+    struct MemoryTempFile *file = findMemoryTempFile(fd);
+    if (file) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        // Keep the file in memory if anything fails, and let the write report any real error.
+        if (offset != -1) {
+            size_t size = atomic_load(&file->size);
+            size_t end = (size_t) offset + count;
+            if (end > size) {
+                size_t grownSize = end - size;
+                size_t totalSize = atomic_fetch_add(&gMemoryTempFilesSize, grownSize) + grownSize;
+                atomic_store(&file->size, end);
+                if (totalSize > atomic_load(&gMemoryTempFileLimit) && spillMemoryTempFile(fd)) {
+                    removeMemoryTempFile(file);
+                }
+            }
+        }
+    }
+    return __real_write(fd, buffer, count);
+}
+
+int __wrap_close(int fd) {
+    closeOutputTempFile(fd);
+    if (atomic_load_explicit(&gMemoryTempFileCount, memory_order_relaxed)) {
+        struct MemoryTempFile *file = findMemoryTempFile(fd);
+        if (file) {
+            removeMemoryTempFile(file);
+        }
+    }
+    return __real_close(fd);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Memory-backed temporary files for libarchive, see memory-temp-file.c.
+
+#ifndef LIBARCHIVE_ANDROID_MEMORY_TEMP_FILE_H
+#define LIBARCHIVE_ANDROID_MEMORY_TEMP_FILE_H
+
+#include <stddef.h>
+
+// Temporary files stay in memory until all of them together would grow beyond the limit, and 0
+// disables them.
+void setMemoryTempFileLimit(size_t limit);
+
+#endif // LIBARCHIVE_ANDROID_MEMORY_TEMP_FILE_H
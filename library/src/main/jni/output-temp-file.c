@@ -0,0 +1,283 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Temporary files of the 7z writer inside its own output, hooked in with the linker's --wrap.
+//
+// The 7z writer stages all packed streams and the header in a temporary file, because the 32-byte
+// signature header that starts the archive points to the header after them. On close, it writes
+// the signature header and then copies the whole temporary file right after it. When the output is
+// a seekable file, the temporary file is instead a duplicate of the output descriptor, which is
+// written at 32 bytes past where the archive starts with pwrite(). On close, reads of it return
+// without reading anything, and writes to the output skip what is already there, so the data is
+// written once and no temporary space is needed.
+//
+// The temporary file is created on whichever thread writes the first entry, so the archive is
+// told apart by the memory entered for it. Like memory temp files, descriptors are looked up in a
+// small table of atomics without any lock, and everything else is only used on the thread of the
+// archive.
+
+// For off64_t and the *64() functions on glibc, which bionic always declares.
+#define _LARGEFILE64_SOURCE
+
+#include "output-temp-file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SIGNATURE_HEADER_SIZE 32
+#define MAX_OUTPUT_TEMP_FILE_COUNT 16
+
+ssize_t __real_read(int fd, void *buffer, size_t count);
+ssize_t __real_write(int fd, const void *buffer, size_t count);
+off_t __real_lseek(int fd, off_t offset, int whence);
+off64_t __real_lseek64(int fd, off64_t offset, int whence);
+
+struct OutputTempFile {
+    // The memory of the archive, or NULL if the slot is free.
+    _Atomic(struct ArchiveMemory *) memory;
+    // The descriptors plus one, so that zero means none.
+    atomic_int outputFdPlusOne;
+    atomic_int tempFdPlusOne;
+    bool isCreated;
+    // Where the temporary file starts in the output.
+    off64_t tempFileStart;
+    off64_t tempFileOffset;
+    off64_t tempFileSize;
+    // The offset of the output descriptor, which libarchive only writes sequentially.
+    off64_t outputOffset;
+};
+
+static struct OutputTempFile gOutputTempFiles[MAX_OUTPUT_TEMP_FILE_COUNT];
+// Keeps every read(), write(), lseek() and close() to a single load when there are none.
+static atomic_size_t gOutputTempFileCount = 0;
+
+static struct OutputTempFile *findOutputTempFileByMemory(struct ArchiveMemory *memory) {
+    for (size_t i = 0; i < MAX_OUTPUT_TEMP_FILE_COUNT; ++i) {
+        struct OutputTempFile *file = &gOutputTempFiles[i];
+        if (atomic_load(&file->memory) == memory) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static struct OutputTempFile *findOutputTempFileByTempFd(int fd) {
+    if (!atomic_load_explicit(&gOutputTempFileCount, memory_order_relaxed)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < MAX_OUTPUT_TEMP_FILE_COUNT; ++i) {
+        struct OutputTempFile *file = &gOutputTempFiles[i];
+        if (atomic_load(&file->tempFdPlusOne) == fd + 1) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+static struct OutputTempFile *findOutputTempFileByOutputFd(int fd) {
+    for (size_t i = 0; i < MAX_OUTPUT_TEMP_FILE_COUNT; ++i) {
+        struct OutputTempFile *file = &gOutputTempFiles[i];
+        if (atomic_load(&file->outputFdPlusOne) == fd + 1) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+bool addOutputTempFile(struct ArchiveMemory *memory, int outputFd) {
+    if (!memory || findOutputTempFileByMemory(memory)) {
+        return false;
+    }
+    // pwrite() appends anyway with O_APPEND.
+    struct stat status;
+    int flags = fcntl(outputFd, F_GETFL);
+    if (fstat(outputFd, &status) || !S_ISREG(status.st_mode) || flags == -1
+            || (flags & O_APPEND)) {
+        return false;
+    }
+    off64_t outputOffset = __real_lseek64(outputFd, 0, SEEK_CUR);
+    if (outputOffset == -1) {
+        return false;
+    }
+    for (size_t i = 0; i < MAX_OUTPUT_TEMP_FILE_COUNT; ++i) {
+        struct OutputTempFile *file = &gOutputTempFiles[i];
+        struct ArchiveMemory *freeMemory = NULL;
+        if (atomic_compare_exchange_strong(&file->memory, &freeMemory, memory)) {
+            file->isCreated = false;
+            file->tempFileStart = outputOffset + SIGNATURE_HEADER_SIZE;
+            file->tempFileOffset = 0;
+            file->tempFileSize = 0;
+            file->outputOffset = outputOffset;
+            atomic_store(&file->tempFdPlusOne, 0);
+            atomic_store(&file->outputFdPlusOne, outputFd + 1);
+            atomic_fetch_add(&gOutputTempFileCount, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void removeOutputTempFile(struct ArchiveMemory *memory) {
+    if (!memory || !atomic_load(&gOutputTempFileCount)) {
+        return;
+    }
+    struct OutputTempFile *file = findOutputTempFileByMemory(memory);
+    if (!file) {
+        return;
+    }
+    // libarchive still closes the duplicate descriptor itself when it frees the archive.
+    atomic_store(&file->outputFdPlusOne, 0);
+    atomic_store(&file->tempFdPlusOne, 0);
+    atomic_fetch_sub(&gOutputTempFileCount, 1);
+    atomic_store(&file->memory, NULL);
+}
+
+int createOutputTempFile(void) {
+    if (!atomic_load(&gOutputTempFileCount)) {
+        return -1;
+    }
+    struct ArchiveMemory *memory = archiveMemoryGetCurrent();
+    struct OutputTempFile *file = memory ? findOutputTempFileByMemory(memory) : NULL;
+    if (!file || file->isCreated) {
+        return -1;
+    }
+    int fd = fcntl(atomic_load(&file->outputFdPlusOne) - 1, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    file->isCreated = true;
+    atomic_store(&file->tempFdPlusOne, fd + 1);
+    return fd;
+}
+
+// Writes to the output only what isn't already there from the temporary file.
+static ssize_t writeOutput(struct OutputTempFile *file, int fd, const void *buffer,
+                           size_t count) {
+    off64_t tempFileEnd = file->tempFileStart + file->tempFileSize;
+    if (file->outputOffset >= file->tempFileStart && file->outputOffset < tempFileEnd) {
+        size_t skipCount = (size_t) (tempFileEnd - file->outputOffset) < count
+                ? (size_t) (tempFileEnd - file->outputOffset) : count;
+        if (__real_lseek64(fd, (off64_t) skipCount, SEEK_CUR) == -1) {
+            return -1;
+        }
+        file->outputOffset += skipCount;
+        return (ssize_t) skipCount;
+    }
+    // Returning a short write makes libarchive write the rest separately.
+    if (file->outputOffset < file->tempFileStart
+            && (size_t) (file->tempFileStart - file->outputOffset) < count) {
+        count = (size_t) (file->tempFileStart - file->outputOffset);
+    }
+    ssize_t bytesWritten = __real_write(fd, buffer, count);
+    if (bytesWritten > 0) {
+        file->outputOffset += bytesWritten;
+    }
+    return bytesWritten;
+}
+
+bool writeOutputTempFile(int fd, const void *buffer, size_t count, ssize_t *outResult) {
+    if (!atomic_load_explicit(&gOutputTempFileCount, memory_order_relaxed)) {
+        return false;
+    }
+    struct OutputTempFile *file = findOutputTempFileByTempFd(fd);
+    if (file) {
+        ssize_t bytesWritten = pwrite64(atomic_load(&file->outputFdPlusOne) - 1, buffer, count,
+                                        file->tempFileStart + file->tempFileOffset);
+        if (bytesWritten > 0) {
+            file->tempFileOffset += bytesWritten;
+            if (file->tempFileOffset > file->tempFileSize) {
+                file->tempFileSize = file->tempFileOffset;
+            }
+        }
+        *outResult = bytesWritten;
+        return true;
+    }
+    file = findOutputTempFileByOutputFd(fd);
+    if (!file || !file->isCreated) {
+        return false;
+    }
+    *outResult = writeOutput(file, fd, buffer, count);
+    return true;
+}
+
+void closeOutputTempFile(int fd) {
+    struct OutputTempFile *file = findOutputTempFileByTempFd(fd);
+    if (file) {
+        atomic_store(&file->tempFdPlusOne, 0);
+    }
+}
+
+// libarchive only reads the temporary file to copy it to the output right after the signature
+// header, which is where it already is.
+ssize_t __wrap_read(int fd, void *buffer, size_t count) {
+    struct OutputTempFile *file = findOutputTempFileByTempFd(fd);
+    if (!file) {
+        return __real_read(fd, buffer, count);
+    }
+    off64_t remainingSize = file->tempFileSize - file->tempFileOffset;
+    if (remainingSize <= 0) {
+        return 0;
+    }
+    size_t readCount = (size_t) remainingSize < count ? (size_t) remainingSize : count;
+    file->tempFileOffset += readCount;
+    return (ssize_t) readCount;
+}
+
+static off64_t seekOutputTempFile(struct OutputTempFile *file, off64_t offset, int whence) {
+    switch (whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += file->tempFileOffset;
+            break;
+        case SEEK_END:
+            offset += file->tempFileSize;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    file->tempFileOffset = offset;
+    return offset;
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence) {
+    struct OutputTempFile *file = findOutputTempFileByTempFd(fd);
+    if (!file) {
+        return __real_lseek(fd, offset, whence);
+    }
+    off64_t result = seekOutputTempFile(file, offset, whence);
+    if (result != (off_t) result) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return (off_t) result;
+}
+
+off64_t __wrap_lseek64(int fd, off64_t offset, int whence) {
+    struct OutputTempFile *file = findOutputTempFileByTempFd(fd);
+    if (!file) {
+        return __real_lseek64(fd, offset, whence);
+    }
+    return seekOutputTempFile(file, offset, whence);
+}
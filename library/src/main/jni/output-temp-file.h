@@ -0,0 +1,44 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Temporary files of the 7z writer inside its own output, see output-temp-file.c.
+
+#ifndef LIBARCHIVE_ANDROID_OUTPUT_TEMP_FILE_H
+#define LIBARCHIVE_ANDROID_OUTPUT_TEMP_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "archive-memory.h"
+
+// Makes the next temporary file of the archive with the memory live in its output, which must be
+// a regular file that the 7z writer has just been opened on without any filter. Returns false if
+// the output can't be used for that, and the temporary file is created as usual then.
+bool addOutputTempFile(struct ArchiveMemory *memory, int outputFd);
+
+// Must be called once the archive is closed, before its output may be closed.
+void removeOutputTempFile(struct ArchiveMemory *memory);
+
+// Returns the temporary file in the output of the archive on this thread, or -1 if there is none.
+int createOutputTempFile(void);
+
+// Returns true with the result in outResult if the write was to an output temp file or its output.
+bool writeOutputTempFile(int fd, const void *buffer, size_t count, ssize_t *outResult);
+
+void closeOutputTempFile(int fd);
+
+#endif // LIBARCHIVE_ANDROID_OUTPUT_TEMP_FILE_H
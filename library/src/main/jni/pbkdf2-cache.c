@@ -0,0 +1,232 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A small process-wide cache for PBKDF2 key derivation, hooked in with the linker's --wrap.
+//
+// libarchive derives the WinZip AES key with PBKDF2 every time an encrypted entry is read. The
+// salt is per entry, so the cache mostly helps when the same archive is opened again, e.g. to
+// extract entries one by one, or when a format or filter retries with the same parameters.
+//
+// The passphrase is only kept as an HMAC-SHA256 under a random per-process secret, so that a memory
+// dump is no cheaper to attack than the archive itself. A derived key is first held as pending,
+// because libarchive only checks the passphrase against the verifier after deriving, and it's only
+// cached once libarchive keys its HMAC with part of it, which it does after a successful check. So
+// wrong passphrases never push good keys out of the cache. Evicted and cleared keys are zeroed.
+
+#include "pbkdf2-cache.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+#include <mbedtls/platform_util.h>
+
+#define KEY_CACHE_SIZE 16
+#define PENDING_KEY_COUNT 4
+#define KEY_CACHE_MAX_SALT_SIZE 64
+#define KEY_CACHE_MAX_KEY_SIZE 128
+// HMAC keys shorter than this aren't matched against pending keys, to avoid matching by chance.
+#define PENDING_KEY_MIN_MATCH_SIZE 16
+
+int __real_mbedtls_pkcs5_pbkdf2_hmac(mbedtls_md_context_t *ctx, const unsigned char *password,
+                                     size_t plen, const unsigned char *salt, size_t slen,
+                                     unsigned int iteration_count, uint32_t key_length,
+                                     unsigned char *output);
+int __real_mbedtls_md_hmac_starts(mbedtls_md_context_t *ctx, const unsigned char *key,
+                                  size_t keylen);
+
+struct KeyCacheEntry {
+    bool valid;
+    uint64_t lastUsed;
+    mbedtls_md_type_t mdType;
+    unsigned char passwordMac[32];
+    unsigned char salt[KEY_CACHE_MAX_SALT_SIZE];
+    size_t saltSize;
+    unsigned int iterationCount;
+    uint32_t keySize;
+    unsigned char key[KEY_CACHE_MAX_KEY_SIZE];
+};
+
+static pthread_once_t gPasswordSecretOnce = PTHREAD_ONCE_INIT;
+static unsigned char gPasswordSecret[32];
+
+static pthread_mutex_t gKeyCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct KeyCacheEntry gKeyCache[KEY_CACHE_SIZE];
+static struct KeyCacheEntry gPendingKeys[PENDING_KEY_COUNT];
+// Read without the lock to keep mbedtls_md_hmac_starts() cheap when nothing is pending.
+static atomic_size_t gPendingKeyCount;
+static uint64_t gKeyCacheClock;
+
+static void initPasswordSecret() {
+    arc4random_buf(gPasswordSecret, sizeof(gPasswordSecret));
+}
+
+static int getPasswordMac(const unsigned char *password, size_t passwordSize,
+                          unsigned char *passwordMac) {
+    pthread_once(&gPasswordSecretOnce, initPasswordSecret);
+    return mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), gPasswordSecret,
+                           sizeof(gPasswordSecret), password, passwordSize, passwordMac);
+}
+
+static struct KeyCacheEntry *findKeyCacheEntry(struct KeyCacheEntry *entries, size_t entryCount,
+                                               mbedtls_md_type_t mdType,
+                                               const unsigned char *passwordMac,
+                                               const unsigned char *salt, size_t saltSize,
+                                               unsigned int iterationCount, uint32_t keySize) {
+    for (size_t i = 0; i < entryCount; ++i) {
+        struct KeyCacheEntry *entry = &entries[i];
+        if (entry->valid && entry->mdType == mdType && entry->iterationCount == iterationCount
+                && entry->keySize == keySize && entry->saltSize == saltSize
+                && !memcmp(entry->salt, salt, saltSize)
+                && !memcmp(entry->passwordMac, passwordMac, sizeof(entry->passwordMac))) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static struct KeyCacheEntry *evictKeyCacheEntry(struct KeyCacheEntry *entries, size_t entryCount) {
+    struct KeyCacheEntry *victim = &entries[0];
+    for (size_t i = 0; i < entryCount; ++i) {
+        struct KeyCacheEntry *entry = &entries[i];
+        if (!entry->valid) {
+            return entry;
+        }
+        if (entry->lastUsed < victim->lastUsed) {
+            victim = entry;
+        }
+    }
+    mbedtls_platform_zeroize(victim, sizeof(*victim));
+    return victim;
+}
+
+// Must be called with the lock.
+static void updatePendingKeyCount() {
+    size_t count = 0;
+    for (size_t i = 0; i < PENDING_KEY_COUNT; ++i) {
+        if (gPendingKeys[i].valid) {
+            ++count;
+        }
+    }
+    atomic_store_explicit(&gPendingKeyCount, count, memory_order_relaxed);
+}
+
+void pbkdf2CacheClear(void) {
+    pthread_mutex_lock(&gKeyCacheMutex);
+    mbedtls_platform_zeroize(gKeyCache, sizeof(gKeyCache));
+    mbedtls_platform_zeroize(gPendingKeys, sizeof(gPendingKeys));
+    updatePendingKeyCount();
+    pthread_mutex_unlock(&gKeyCacheMutex);
+}
+
+int __wrap_mbedtls_pkcs5_pbkdf2_hmac(mbedtls_md_context_t *ctx, const unsigned char *password,
+                                     size_t plen, const unsigned char *salt, size_t slen,
+                                     unsigned int iteration_count, uint32_t key_length,
+                                     unsigned char *output) {
+    if (!ctx || !ctx->md_info || slen > KEY_CACHE_MAX_SALT_SIZE
+            || key_length > KEY_CACHE_MAX_KEY_SIZE) {
+        return __real_mbedtls_pkcs5_pbkdf2_hmac(ctx, password, plen, salt, slen, iteration_count,
+                                                key_length, output);
+    }
+    mbedtls_md_type_t mdType = mbedtls_md_get_type(ctx->md_info);
+    unsigned char passwordMac[32];
+    if (getPasswordMac(password, plen, passwordMac)) {
+        return __real_mbedtls_pkcs5_pbkdf2_hmac(ctx, password, plen, salt, slen, iteration_count,
+                                                key_length, output);
+    }
+    pthread_mutex_lock(&gKeyCacheMutex);
+    struct KeyCacheEntry *entry = findKeyCacheEntry(gKeyCache, KEY_CACHE_SIZE, mdType,
+                                                    passwordMac, salt, slen, iteration_count,
+                                                    key_length);
+    if (!entry) {
+        entry = findKeyCacheEntry(gPendingKeys, PENDING_KEY_COUNT, mdType, passwordMac, salt,
+                                  slen, iteration_count, key_length);
+    }
+    if (entry) {
+        memcpy(output, entry->key, key_length);
+        entry->lastUsed = ++gKeyCacheClock;
+        pthread_mutex_unlock(&gKeyCacheMutex);
+        mbedtls_platform_zeroize(passwordMac, sizeof(passwordMac));
+        return 0;
+    }
+    pthread_mutex_unlock(&gKeyCacheMutex);
+    int ret = __real_mbedtls_pkcs5_pbkdf2_hmac(ctx, password, plen, salt, slen, iteration_count,
+                                               key_length, output);
+    if (!ret) {
+        pthread_mutex_lock(&gKeyCacheMutex);
+        // Another thread may have derived the same key in the meantime.
+        if (!findKeyCacheEntry(gKeyCache, KEY_CACHE_SIZE, mdType, passwordMac, salt, slen,
+                               iteration_count, key_length)
+                && !findKeyCacheEntry(gPendingKeys, PENDING_KEY_COUNT, mdType, passwordMac, salt,
+                                      slen, iteration_count, key_length)) {
+            entry = evictKeyCacheEntry(gPendingKeys, PENDING_KEY_COUNT);
+            entry->valid = true;
+            entry->lastUsed = ++gKeyCacheClock;
+            entry->mdType = mdType;
+            memcpy(entry->passwordMac, passwordMac, sizeof(passwordMac));
+            memcpy(entry->salt, salt, slen);
+            entry->saltSize = slen;
+            entry->iterationCount = iteration_count;
+            entry->keySize = key_length;
+            memcpy(entry->key, output, key_length);
+            updatePendingKeyCount();
+        }
+        pthread_mutex_unlock(&gKeyCacheMutex);
+    }
+    mbedtls_platform_zeroize(passwordMac, sizeof(passwordMac));
+    return ret;
+}
+
+static bool isPartOfKey(const struct KeyCacheEntry *entry, const unsigned char *key,
+                        size_t keySize) {
+    if (keySize < PENDING_KEY_MIN_MATCH_SIZE || keySize > entry->keySize) {
+        return false;
+    }
+    for (size_t offset = 0; offset <= entry->keySize - keySize; ++offset) {
+        if (!memcmp(entry->key + offset, key, keySize)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// libarchive keys its HMAC with part of the derived key only once the passphrase has been
+// verified, so that is when a pending key is moved into the cache.
+int __wrap_mbedtls_md_hmac_starts(mbedtls_md_context_t *ctx, const unsigned char *key,
+                                  size_t keylen) {
+    if (atomic_load_explicit(&gPendingKeyCount, memory_order_relaxed)) {
+        pthread_mutex_lock(&gKeyCacheMutex);
+        for (size_t i = 0; i < PENDING_KEY_COUNT; ++i) {
+            struct KeyCacheEntry *pendingEntry = &gPendingKeys[i];
+            if (!pendingEntry->valid || !isPartOfKey(pendingEntry, key, keylen)) {
+                continue;
+            }
+            struct KeyCacheEntry *entry = evictKeyCacheEntry(gKeyCache, KEY_CACHE_SIZE);
+            *entry = *pendingEntry;
+            entry->lastUsed = ++gKeyCacheClock;
+            mbedtls_platform_zeroize(pendingEntry, sizeof(*pendingEntry));
+            updatePendingKeyCount();
+            break;
+        }
+        pthread_mutex_unlock(&gKeyCacheMutex);
+    }
+    return __real_mbedtls_md_hmac_starts(ctx, key, keylen);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A process-wide cache for PBKDF2 key derivation, see pbkdf2-cache.c.
+
+#ifndef LIBARCHIVE_ANDROID_PBKDF2_CACHE_H
+#define LIBARCHIVE_ANDROID_PBKDF2_CACHE_H
+
+// Zeroes and drops all cached keys, e.g. once the app is done with an encrypted archive.
+void pbkdf2CacheClear(void);
+
+#endif // LIBARCHIVE_ANDROID_PBKDF2_CACHE_H
@@ -0,0 +1,394 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SIMD b64encode and uuencode write filters, hooked in with the linker's --wrap.
+//
+// libarchive's filters encode one byte triple at a time and append every character to an
+// archive_string separately. These replacements produce the same output, i.e. the same begin line
+// with the mode and name options, lines of 57 (base64) or 45 (uuencode) input bytes and the same
+// end lines, and are registered under the same name and code, so that adding a filter by name or
+// code also gets them. The bulk of each line is encoded with NEON or SSSE3, which are part of the
+// respective Android ABI baselines, and the rest of it with scalar code. The uu read filter still
+// decodes with libarchive's code.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <archive.h>
+
+// archive_write_private.h is private to libarchive. archive.h is included first because it would
+// otherwise want libarchive's own Android headers.
+#define __LIBARCHIVE_BUILD
+#include <archive_write_private.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_UU_SIMD 1
+#elif defined(__SSSE3__)
+#include <immintrin.h>
+#define HAVE_UU_SIMD 1
+#endif
+
+#define B64ENCODE_LINE_SIZE 57
+#define UUENCODE_LINE_SIZE 45
+#define MAX_LINE_SIZE B64ENCODE_LINE_SIZE
+// An encoded line, with the length character of uuencode and the newline.
+#define MAX_ENCODED_LINE_SIZE (1 + MAX_LINE_SIZE / 3 * 4 + 1)
+#define DEFAULT_BUFFER_SIZE 65536
+
+static const char BASE64_ALPHABET[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct UuWriteFilter {
+    bool isBase64;
+    int mode;
+    char *name;
+    size_t lineSize;
+    // Input bytes that don't make a whole line yet.
+    uint8_t hold[MAX_LINE_SIZE];
+    size_t holdSize;
+    // Encoded output, which is passed on in chunks of bufferSize.
+    char *buffer;
+    size_t bufferSize;
+    size_t bufferLength;
+};
+
+static inline char encodeUu(unsigned int value) {
+    return (char) (value ? value + 0x20 : '`');
+}
+
+static inline char encodeSixBits(const struct UuWriteFilter *filter, unsigned int value) {
+    return filter->isBase64 ? BASE64_ALPHABET[value] : encodeUu(value);
+}
+
+#if defined(HAVE_UU_SIMD)
+
+#if defined(__ARM_NEON)
+
+// Maps the 6-bit values in each byte to base64 characters.
+static inline uint8x16_t translateBase64(uint8x16_t values) {
+    // 'A' for 0-25, 'a' - 26 for 26-51, '0' - 52 for 52-61, '+' - 62 for 62 and '/' - 63 for 63.
+    uint8x16_t offsets = vdupq_n_u8('A');
+    offsets = vbslq_u8(vcgtq_u8(values, vdupq_n_u8(25)), vdupq_n_u8('a' - 26), offsets);
+    offsets = vbslq_u8(vcgtq_u8(values, vdupq_n_u8(51)), vdupq_n_u8((uint8_t) ('0' - 52)),
+                       offsets);
+    offsets = vbslq_u8(vceqq_u8(values, vdupq_n_u8(62)), vdupq_n_u8((uint8_t) ('+' - 62)),
+                       offsets);
+    offsets = vbslq_u8(vceqq_u8(values, vdupq_n_u8(63)), vdupq_n_u8((uint8_t) ('/' - 63)),
+                       offsets);
+    return vaddq_u8(values, offsets);
+}
+
+// Maps the 6-bit values in each byte to uuencode characters, with '`' instead of space for 0.
+static inline uint8x16_t translateUu(uint8x16_t values) {
+    uint8x16_t zeroMask = vceqq_u8(values, vdupq_n_u8(0));
+    return vaddq_u8(vaddq_u8(values, vdupq_n_u8(0x20)), vandq_u8(zeroMask, vdupq_n_u8(0x40)));
+}
+
+// Encodes 48 bytes into 64 characters, with the triples split across the three registers.
+static size_t encodeSimd(bool isBase64, const uint8_t *input, size_t size, char *output) {
+    size_t encodedSize = 0;
+    for (; size >= 48; input += 48, size -= 48, output += 64, encodedSize += 48) {
+        uint8x16x3_t in = vld3q_u8(input);
+        uint8x16x4_t out;
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4),
+                              vshrq_n_u8(in.val[1], 4));
+        out.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0F)), 2),
+                              vshrq_n_u8(in.val[2], 6));
+        out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+        for (int i = 0; i < 4; ++i) {
+            out.val[i] = isBase64 ? translateBase64(out.val[i]) : translateUu(out.val[i]);
+        }
+        vst4q_u8((uint8_t *) output, out);
+    }
+    return encodedSize;
+}
+
+#else // __SSSE3__
+
+// Maps the 6-bit values in each byte to base64 characters, by looking up the offset to add for
+// each range of values.
+static inline __m128i translateBase64(__m128i values) {
+    // 0-25 -> 0 ('A'), 26-51 -> 1 ('a' - 26), 52-61 -> 2-11 ('0' - 52), 62 -> 12 ('+' - 62) and
+    // 63 -> 13 ('/' - 63).
+    __m128i indices = _mm_subs_epu8(values, _mm_set1_epi8(51));
+    indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+    __m128i offsets = _mm_setr_epi8('A', 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                    '+' - 62, '/' - 63, 0, 0);
+    return _mm_add_epi8(values, _mm_shuffle_epi8(offsets, indices));
+}
+
+// Maps the 6-bit values in each byte to uuencode characters, with '`' instead of space for 0.
+static inline __m128i translateUu(__m128i values) {
+    __m128i zeroMask = _mm_cmpeq_epi8(values, _mm_setzero_si128());
+    return _mm_add_epi8(_mm_add_epi8(values, _mm_set1_epi8(0x20)),
+                        _mm_and_si128(zeroMask, _mm_set1_epi8(0x40)));
+}
+
+// Encodes 12 bytes into 16 characters at a time, which loads 16 bytes.
+static size_t encodeSimd(bool isBase64, const uint8_t *input, size_t size, char *output) {
+    size_t encodedSize = 0;
+    for (; size >= 16; input += 12, size -= 12, output += 16, encodedSize += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *) input);
+        // Puts the bytes of each triple into a 32-bit lane as b1 b0 b2 b1 (little endian), so
+        // that the four 6-bit values can be shifted into place with 16-bit multiplies.
+        in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11,
+                                                10));
+        __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                                       _mm_set1_epi32(0x04000040));
+        __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                                      _mm_set1_epi32(0x01000010));
+        __m128i values = _mm_or_si128(high, low);
+        values = isBase64 ? translateBase64(values) : translateUu(values);
+        _mm_storeu_si128((__m128i *) output, values);
+    }
+    return encodedSize;
+}
+
+#endif
+
+#endif // HAVE_UU_SIMD
+
+// Encodes one line the way libarchive does, padding a partial triple with '=' for base64 or '`'
+// for uuencode, and returns the number of characters.
+static size_t encodeLine(const struct UuWriteFilter *filter, const uint8_t *input, size_t size,
+                         char *output) {
+    char *start = output;
+    if (!filter->isBase64) {
+        *output++ = encodeUu((unsigned int) size);
+    }
+    size_t encodedSize = 0;
+#if defined(HAVE_UU_SIMD)
+    encodedSize = encodeSimd(filter->isBase64, input, size, output);
+    output += encodedSize / 3 * 4;
+#endif
+    for (; size - encodedSize >= 3; encodedSize += 3) {
+        const uint8_t *p = input + encodedSize;
+        *output++ = encodeSixBits(filter, p[0] >> 2);
+        *output++ = encodeSixBits(filter, ((p[0] & 0x03) << 4) | (p[1] >> 4));
+        *output++ = encodeSixBits(filter, ((p[1] & 0x0F) << 2) | (p[2] >> 6));
+        *output++ = encodeSixBits(filter, p[2] & 0x3F);
+    }
+    if (size > encodedSize) {
+        const uint8_t *p = input + encodedSize;
+        char padding = filter->isBase64 ? '=' : '`';
+        *output++ = encodeSixBits(filter, p[0] >> 2);
+        if (size - encodedSize == 1) {
+            *output++ = encodeSixBits(filter, (p[0] & 0x03) << 4);
+            *output++ = padding;
+        } else {
+            *output++ = encodeSixBits(filter, ((p[0] & 0x03) << 4) | (p[1] >> 4));
+            *output++ = encodeSixBits(filter, (p[1] & 0x0F) << 2);
+        }
+        *output++ = padding;
+    }
+    *output++ = '\n';
+    return (size_t) (output - start);
+}
+
+// Passes on the buffered output in whole chunks of the buffer size.
+static int flushBuffer(struct archive_write_filter *f) {
+    struct UuWriteFilter *filter = f->data;
+    int errorCode = ARCHIVE_OK;
+    size_t offset = 0;
+    while (filter->bufferLength - offset >= filter->bufferSize) {
+        errorCode = __archive_write_filter(f->next_filter, filter->buffer + offset,
+                                           filter->bufferSize);
+        offset += filter->bufferSize;
+        if (errorCode != ARCHIVE_OK) {
+            break;
+        }
+    }
+    memmove(filter->buffer, filter->buffer + offset, filter->bufferLength - offset);
+    filter->bufferLength -= offset;
+    return errorCode;
+}
+
+// Like libarchive's atol8(), which stops at the first non-octal digit.
+static int parseOctal(const char *string) {
+    int value = 0;
+    for (; *string >= '0' && *string <= '7'; ++string) {
+        value = (value << 3) | (*string - '0');
+    }
+    return value;
+}
+
+static int uuWriteFilterOptions(struct archive_write_filter *f, const char *key,
+                                const char *value) {
+    struct UuWriteFilter *filter = f->data;
+    if (!strcmp(key, "mode")) {
+        if (!value) {
+            archive_set_error(f->archive, EINVAL, "mode option requires octal digits");
+            return ARCHIVE_FAILED;
+        }
+        filter->mode = parseOctal(value) & 0777;
+        return ARCHIVE_OK;
+    } else if (!strcmp(key, "name")) {
+        if (!value) {
+            archive_set_error(f->archive, EINVAL, "name option requires a string");
+            return ARCHIVE_FAILED;
+        }
+        char *name = strdup(value);
+        if (!name) {
+            archive_set_error(f->archive, ENOMEM, "Can't allocate data for %s filter", f->name);
+            return ARCHIVE_FATAL;
+        }
+        free(filter->name);
+        filter->name = name;
+        return ARCHIVE_OK;
+    }
+    // Lets libarchive report an option that no one handled.
+    return ARCHIVE_WARN;
+}
+
+static int uuWriteFilterOpen(struct archive_write_filter *f) {
+    struct UuWriteFilter *filter = f->data;
+    // Like libarchive, keeps the chunks a multiple of the block size.
+    size_t bufferSize = DEFAULT_BUFFER_SIZE;
+    if (f->archive->magic == ARCHIVE_WRITE_MAGIC) {
+        int bytesPerBlock = archive_write_get_bytes_per_block(f->archive);
+        if (bytesPerBlock > 0) {
+            if ((size_t) bytesPerBlock > bufferSize) {
+                bufferSize = (size_t) bytesPerBlock;
+            } else {
+                bufferSize -= bufferSize % (size_t) bytesPerBlock;
+            }
+        }
+    }
+    const char *beginFormat = filter->isBase64 ? "begin-base64 %o %s\n" : "begin %o %s\n";
+    int beginLength = snprintf(NULL, 0, beginFormat, filter->mode, filter->name);
+    // Room for the begin line, a chunk and a line that doesn't fit in it yet.
+    size_t capacity = (size_t) beginLength + 1 + bufferSize + MAX_ENCODED_LINE_SIZE;
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        archive_set_error(f->archive, ENOMEM, "Can't allocate data for %s buffer", f->name);
+        return ARCHIVE_FATAL;
+    }
+    free(filter->buffer);
+    filter->buffer = buffer;
+    filter->bufferSize = bufferSize;
+    filter->bufferLength = (size_t) snprintf(buffer, capacity, beginFormat, filter->mode,
+                                             filter->name);
+    filter->holdSize = 0;
+    return ARCHIVE_OK;
+}
+
+static int uuWriteFilterWrite(struct archive_write_filter *f, const void *buffer, size_t length) {
+    struct UuWriteFilter *filter = f->data;
+    const uint8_t *input = buffer;
+    int errorCode = ARCHIVE_OK;
+    if (filter->holdSize) {
+        size_t fillSize = filter->lineSize - filter->holdSize;
+        if (length < fillSize) {
+            memcpy(filter->hold + filter->holdSize, input, length);
+            filter->holdSize += length;
+            return ARCHIVE_OK;
+        }
+        memcpy(filter->hold + filter->holdSize, input, fillSize);
+        input += fillSize;
+        length -= fillSize;
+        filter->bufferLength += encodeLine(filter, filter->hold, filter->lineSize,
+                                           filter->buffer + filter->bufferLength);
+        filter->holdSize = 0;
+    }
+    while (length >= filter->lineSize) {
+        filter->bufferLength += encodeLine(filter, input, filter->lineSize,
+                                           filter->buffer + filter->bufferLength);
+        input += filter->lineSize;
+        length -= filter->lineSize;
+        if (filter->bufferLength >= filter->bufferSize) {
+            errorCode = flushBuffer(f);
+            if (errorCode != ARCHIVE_OK) {
+                return errorCode;
+            }
+        }
+    }
+    memcpy(filter->hold, input, length);
+    filter->holdSize = length;
+    if (filter->bufferLength >= filter->bufferSize) {
+        errorCode = flushBuffer(f);
+    }
+    return errorCode;
+}
+
+static int uuWriteFilterClose(struct archive_write_filter *f) {
+    struct UuWriteFilter *filter = f->data;
+    if (filter->holdSize) {
+        filter->bufferLength += encodeLine(filter, filter->hold, filter->holdSize,
+                                           filter->buffer + filter->bufferLength);
+        filter->holdSize = 0;
+    }
+    int errorCode = flushBuffer(f);
+    if (errorCode != ARCHIVE_OK) {
+        return errorCode;
+    }
+    const char *end = filter->isBase64 ? "====\n" : "`\nend\n";
+    size_t endLength = strlen(end);
+    memcpy(filter->buffer + filter->bufferLength, end, endLength);
+    filter->bufferLength += endLength;
+    archive_write_set_bytes_in_last_block(f->archive, 1);
+    return __archive_write_filter(f->next_filter, filter->buffer, filter->bufferLength);
+}
+
+static int uuWriteFilterFree(struct archive_write_filter *f) {
+    struct UuWriteFilter *filter = f->data;
+    free(filter->name);
+    free(filter->buffer);
+    free(filter);
+    f->data = NULL;
+    return ARCHIVE_OK;
+}
+
+static int addUuWriteFilter(struct archive *archive, bool isBase64, const char *functionName) {
+    archive_check_magic(archive, ARCHIVE_WRITE_MAGIC, ARCHIVE_STATE_NEW, functionName);
+    struct archive_write_filter *f = __archive_write_allocate_filter(archive);
+    const char *name = isBase64 ? "b64encode" : "uuencode";
+    struct UuWriteFilter *filter = calloc(1, sizeof(*filter));
+    char *fileName = strdup("-");
+    if (!filter || !fileName) {
+        free(filter);
+        free(fileName);
+        archive_set_error(archive, ENOMEM, "Can't allocate data for %s filter", name);
+        return ARCHIVE_FATAL;
+    }
+    filter->isBase64 = isBase64;
+    filter->mode = 0644;
+    filter->name = fileName;
+    filter->lineSize = isBase64 ? B64ENCODE_LINE_SIZE : UUENCODE_LINE_SIZE;
+    f->data = filter;
+    f->name = name;
+    f->code = ARCHIVE_FILTER_UU;
+    f->options = uuWriteFilterOptions;
+    f->open = uuWriteFilterOpen;
+    f->write = uuWriteFilterWrite;
+    f->close = uuWriteFilterClose;
+    f->free = uuWriteFilterFree;
+    return ARCHIVE_OK;
+}
+
+int __wrap_archive_write_add_filter_b64encode(struct archive *archive) {
+    return addUuWriteFilter(archive, true, "archive_write_add_filter_b64encode");
+}
+
+int __wrap_archive_write_add_filter_uuencode(struct archive *archive) {
+    return addUuWriteFilter(archive, false, "archive_write_add_filter_uuencode");
+}
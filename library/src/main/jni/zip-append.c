@@ -0,0 +1,820 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Appending to a zip normally means reading and rewriting the whole archive, because libarchive's
+// zip writer only produces complete archives. However, the entries of a zip are only listed in the
+// central directory at its end, so new entries can be written over the old central directory
+// instead, followed by a central directory of both the old and the new entries.
+//
+// libarchive's output is written as if it started at the old central directory offset, and on
+// close its central directory is merged with the old one, with the local header offsets of the new
+// entries moved by that offset, and zip64 fields and records added where they no longer fit. The
+// file has no valid central directory in the meantime, so the old one is written back if libarchive
+// doesn't finish.
+//
+// Entries of other zips can also be copied between libarchive's entries without decompressing
+// them, which only needs their local and central directory headers to be rewritten with the new
+// name and offset. libarchive's output after a copy is moved by its size, which is accounted for
+// in the same way when merging.
+//
+// Stored entries can also have their data aligned for memory mapping as zipalign does, by padding
+// their local headers with an extra field. libarchive's local headers are held back until complete
+// for this, and the padding is inserted into its output like a copied entry without a central
+// directory header.
+
+// Zips may be larger than 2 GiB on 32-bit ABIs too.
+#define _FILE_OFFSET_BITS 64
+
+#include "zip-append.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "zip-format.h"
+
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+// Bytes inserted after streamOffset bytes of libarchive's output, either an entry copied from
+// another zip or the padding of a local header, which has no central directory header.
+struct Insertion {
+    uint64_t streamOffset;
+    uint64_t size;
+    size_t centralHeaderSize;
+};
+
+struct Bytes {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct ZipAppend {
+    int fd;
+    // Where the old central directory starts, and libarchive's output with it.
+    uint64_t baseOffset;
+    // Everything from the old central directory to the end of file, for merging and restoring.
+    uint8_t *oldTail;
+    size_t oldTailSize;
+    uint64_t oldEntryCount;
+    size_t oldCentralDirectorySize;
+    size_t commentSize;
+    uint64_t writtenSize;
+    struct Insertion *insertions;
+    size_t insertionCount;
+    size_t insertionCapacity;
+    uint64_t insertedSize;
+    size_t copiedEntryCount;
+    // Central directory headers of the copied entries, with their new names and offsets.
+    struct Bytes copiedCentralDirectory;
+    uint32_t alignment;
+    uint32_t sharedLibraryAlignment;
+    // A local header from libarchive is held back until complete, so that it can be padded.
+    bool isLocalHeaderPending;
+    struct Bytes pendingLocalHeader;
+    bool isClosed;
+    // The errno of a failed close, or 0.
+    int closeErrno;
+};
+
+static void putU16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = (uint8_t) value;
+    bytes[1] = (uint8_t) (value >> 8);
+}
+
+static void putU32(uint8_t *bytes, uint32_t value) {
+    putU16(bytes, (uint16_t) value);
+    putU16(bytes + 2, (uint16_t) (value >> 16));
+}
+
+static void putU64(uint8_t *bytes, uint64_t value) {
+    putU32(bytes, (uint32_t) value);
+    putU32(bytes + 4, (uint32_t) (value >> 32));
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size, uint64_t offset) {
+    const uint8_t *bytes = buffer;
+    while (size) {
+        ssize_t bytesWritten = pwrite(fd, bytes, size, (off_t) offset);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += bytesWritten;
+        size -= bytesWritten;
+        offset += bytesWritten;
+    }
+    return true;
+}
+
+// Returns a pointer to size bytes to be filled in, or NULL with errno set.
+static uint8_t *appendBytes(struct Bytes *bytes, size_t size) {
+    if (bytes->size + size > bytes->capacity) {
+        size_t capacity = bytes->capacity ? bytes->capacity : 4096;
+        while (capacity < bytes->size + size) {
+            capacity *= 2;
+        }
+        uint8_t *data = realloc(bytes->data, capacity);
+        if (!data) {
+            return NULL;
+        }
+        bytes->data = data;
+        bytes->capacity = capacity;
+    }
+    uint8_t *data = bytes->data + bytes->size;
+    bytes->size += size;
+    return data;
+}
+
+static bool addInsertion(struct ZipAppend *zipAppend, uint64_t size, size_t centralHeaderSize) {
+    if (zipAppend->insertionCount == zipAppend->insertionCapacity) {
+        size_t capacity = zipAppend->insertionCapacity ? zipAppend->insertionCapacity * 2 : 16;
+        struct Insertion *insertions = realloc(zipAppend->insertions,
+                capacity * sizeof(*insertions));
+        if (!insertions) {
+            return false;
+        }
+        zipAppend->insertions = insertions;
+        zipAppend->insertionCapacity = capacity;
+    }
+    struct Insertion *insertion = &zipAppend->insertions[zipAppend->insertionCount++];
+    insertion->streamOffset = zipAppend->writtenSize;
+    insertion->size = size;
+    insertion->centralHeaderSize = centralHeaderSize;
+    zipAppend->insertedSize += size;
+    return true;
+}
+
+struct ZipAppend *zipAppendOpen(int fd) {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat)) {
+        return NULL;
+    }
+    // An empty file is a new zip.
+    struct ZipCentralDirectoryInfo info = { 0 };
+    if (fileStat.st_size
+            && !zipReadCentralDirectoryInfo(fd, 0, (uint64_t) fileStat.st_size, &info)) {
+        return NULL;
+    }
+    struct ZipAppend *zipAppend = calloc(1, sizeof(*zipAppend));
+    if (!zipAppend) {
+        return NULL;
+    }
+    zipAppend->fd = fd;
+    zipAppend->baseOffset = info.offset;
+    zipAppend->oldTailSize = (size_t) ((uint64_t) fileStat.st_size - info.offset);
+    zipAppend->oldTail = malloc(zipAppend->oldTailSize ? zipAppend->oldTailSize : 1);
+    if (!zipAppend->oldTail) {
+        free(zipAppend);
+        return NULL;
+    }
+    if (!zipReadFully(fd, zipAppend->oldTail, zipAppend->oldTailSize, info.offset)) {
+        int savedErrno = errno;
+        free(zipAppend->oldTail);
+        free(zipAppend);
+        errno = savedErrno;
+        return NULL;
+    }
+    zipAppend->oldEntryCount = info.entryCount;
+    zipAppend->oldCentralDirectorySize = (size_t) info.size;
+    zipAppend->commentSize = info.commentSize;
+    return zipAppend;
+}
+
+void zipAppendSetAlignment(struct ZipAppend *zipAppend, uint32_t alignment,
+                           uint32_t sharedLibraryAlignment) {
+    zipAppend->alignment = alignment;
+    zipAppend->sharedLibraryAlignment = sharedLibraryAlignment;
+}
+
+void zipAppendBeginEntry(struct ZipAppend *zipAppend) {
+    if (zipAppend->alignment > 1 || zipAppend->sharedLibraryAlignment > 1) {
+        zipAppend->isLocalHeaderPending = true;
+    }
+}
+
+// Returns the size of the alignment extra field to add to the complete local header at offset, or
+// 0 if the entry isn't stored, is already aligned or has no room left in its extra field.
+static size_t getAlignmentPaddingSize(const struct ZipAppend *zipAppend,
+                                      const uint8_t *localHeader, uint64_t offset,
+                                      uint32_t *alignment) {
+    size_t nameSize = zipGetU16(localHeader + 26);
+    size_t extraSize = zipGetU16(localHeader + 28);
+    const uint8_t *name = localHeader + ZIP_LOCAL_HEADER_SIZE;
+    bool isSharedLibrary = nameSize >= 3 && !memcmp(name + nameSize - 3, ".so", 3);
+    *alignment = isSharedLibrary && zipAppend->sharedLibraryAlignment
+            ? zipAppend->sharedLibraryAlignment : zipAppend->alignment;
+    if (*alignment <= 1 || zipGetU16(localHeader + 8)) {
+        return 0;
+    }
+    uint64_t dataOffset = offset + ZIP_LOCAL_HEADER_SIZE + nameSize + extraSize;
+    size_t paddingSize = (size_t) ((*alignment - dataOffset % *alignment) % *alignment);
+    if (!paddingSize) {
+        return 0;
+    }
+    while (paddingSize < ZIP_ALIGNMENT_EXTRA_MIN_SIZE) {
+        paddingSize += *alignment;
+    }
+    return extraSize + paddingSize <= UINT16_MAX ? paddingSize : 0;
+}
+
+static void putAlignmentExtra(uint8_t *extra, size_t size, uint32_t alignment) {
+    putU16(extra, ZIP_ALIGNMENT_EXTRA_ID);
+    putU16(extra + 2, (uint16_t) (size - 4));
+    putU16(extra + 4, (uint16_t) alignment);
+    memset(extra + ZIP_ALIGNMENT_EXTRA_MIN_SIZE, 0, size - ZIP_ALIGNMENT_EXTRA_MIN_SIZE);
+}
+
+// Writes the pending local header, padded if it's complete, with the padding as an insertion.
+static bool writePendingLocalHeader(struct ZipAppend *zipAppend, bool isComplete) {
+    struct Bytes *localHeader = &zipAppend->pendingLocalHeader;
+    size_t localHeaderSize = localHeader->size;
+    zipAppend->isLocalHeaderPending = false;
+    uint64_t offset = zipAppend->baseOffset + zipAppend->insertedSize + zipAppend->writtenSize;
+    uint32_t alignment = 0;
+    size_t paddingSize = isComplete ? getAlignmentPaddingSize(zipAppend, localHeader->data, offset,
+            &alignment) : 0;
+    bool isSuccessful = true;
+    if (paddingSize) {
+        uint8_t *padding = appendBytes(localHeader, paddingSize);
+        if (padding) {
+            putAlignmentExtra(padding, paddingSize, alignment);
+            putU16(localHeader->data + 28, (uint16_t) (zipGetU16(localHeader->data + 28)
+                    + paddingSize));
+        } else {
+            isSuccessful = false;
+        }
+    }
+    isSuccessful = isSuccessful && writeFully(zipAppend->fd, localHeader->data, localHeader->size,
+            offset);
+    localHeader->size = 0;
+    if (!isSuccessful) {
+        return false;
+    }
+    zipAppend->writtenSize += localHeaderSize;
+    // The padding moves the rest of libarchive's output like a copied entry does.
+    return !paddingSize || addInsertion(zipAppend, paddingSize, 0);
+}
+
+static size_t getLocalHeaderSize(const uint8_t *localHeader) {
+    return ZIP_LOCAL_HEADER_SIZE + (size_t) zipGetU16(localHeader + 26)
+            + zipGetU16(localHeader + 28);
+}
+
+// Takes as much of the pending local header as the buffer has, and writes it once it's complete
+// or turns out not to be a local header. Returns the size taken, or -1 with errno set.
+static ssize_t takePendingLocalHeader(struct ZipAppend *zipAppend, const uint8_t *buffer,
+                                      size_t size) {
+    struct Bytes *localHeader = &zipAppend->pendingLocalHeader;
+    // The signature is checked first, then the sizes of the name and the extra field are read.
+    size_t localHeaderSize = localHeader->size < 4 ? 4
+            : localHeader->size < ZIP_LOCAL_HEADER_SIZE ? ZIP_LOCAL_HEADER_SIZE
+            : getLocalHeaderSize(localHeader->data);
+    size_t takenSize = localHeaderSize - localHeader->size;
+    if (takenSize > size) {
+        takenSize = size;
+    }
+    if (takenSize) {
+        uint8_t *bytes = appendBytes(localHeader, takenSize);
+        if (!bytes) {
+            return -1;
+        }
+        memcpy(bytes, buffer, takenSize);
+    }
+    if (localHeader->size == 4 && zipGetU32(localHeader->data) != ZIP_LOCAL_HEADER_SIGNATURE) {
+        // libarchive didn't write a header after all, e.g. because the entry was rejected.
+        return writePendingLocalHeader(zipAppend, false) ? (ssize_t) takenSize : -1;
+    }
+    if (localHeader->size >= ZIP_LOCAL_HEADER_SIZE
+            && localHeader->size == getLocalHeaderSize(localHeader->data)) {
+        return writePendingLocalHeader(zipAppend, true) ? (ssize_t) takenSize : -1;
+    }
+    return (ssize_t) takenSize;
+}
+
+ssize_t zipAppendWrite(struct ZipAppend *zipAppend, const void *buffer, size_t size) {
+    const uint8_t *bytes = buffer;
+    size_t remainingSize = size;
+    while (zipAppend->isLocalHeaderPending && remainingSize) {
+        ssize_t takenSize = takePendingLocalHeader(zipAppend, bytes, remainingSize);
+        if (takenSize < 0) {
+            return -1;
+        }
+        bytes += takenSize;
+        remainingSize -= takenSize;
+    }
+    uint64_t offset = zipAppend->baseOffset + zipAppend->insertedSize + zipAppend->writtenSize;
+    if (!writeFully(zipAppend->fd, bytes, remainingSize, offset)) {
+        return -1;
+    }
+    zipAppend->writtenSize += remainingSize;
+    return (ssize_t) size;
+}
+
+static bool restoreOldTail(struct ZipAppend *zipAppend) {
+    uint64_t end = zipAppend->baseOffset + zipAppend->oldTailSize;
+    return writeFully(zipAppend->fd, zipAppend->oldTail, zipAppend->oldTailSize,
+            zipAppend->baseOffset) && !ftruncate(zipAppend->fd, (off_t) end);
+}
+
+// Appends a central directory header with its local header offset moved by offsetDelta, moving the
+// offset into the zip64 extra field if it no longer fits.
+static bool appendMovedCentralHeader(struct Bytes *bytes, const uint8_t *header, size_t headerSize,
+                                     uint64_t offsetDelta) {
+    size_t nameSize = zipGetU16(header + 28);
+    size_t extraSize = zipGetU16(header + 30);
+    const uint8_t *extra = header + ZIP_CENTRAL_HEADER_SIZE + nameSize;
+    size_t zip64ExtraSize;
+    const uint8_t *zip64Extra = zipFindZip64Extra(extra, extraSize, &zip64ExtraSize);
+    size_t zip64OffsetPosition = zipGetZip64ExtraPosition(header, 42);
+    uint32_t offset32 = zipGetU32(header + 42);
+    if (offset32 == UINT32_MAX) {
+        if (!zip64Extra || zip64OffsetPosition + 8 > zip64ExtraSize) {
+            errno = EINVAL;
+            return false;
+        }
+        uint8_t *newHeader = appendBytes(bytes, headerSize);
+        if (!newHeader) {
+            return false;
+        }
+        memcpy(newHeader, header, headerSize);
+        uint8_t *offset = newHeader + (zip64Extra - header) + zip64OffsetPosition;
+        putU64(offset, zipGetU64(offset) + offsetDelta);
+        return true;
+    }
+    uint64_t offset = offset32 + offsetDelta;
+    if (offset < UINT32_MAX) {
+        uint8_t *newHeader = appendBytes(bytes, headerSize);
+        if (!newHeader) {
+            return false;
+        }
+        memcpy(newHeader, header, headerSize);
+        putU32(newHeader + 42, (uint32_t) offset);
+        return true;
+    }
+    if (extraSize + (zip64Extra ? 8 : 12) > UINT16_MAX
+            || zip64OffsetPosition > (zip64Extra ? zip64ExtraSize : 0)) {
+        errno = EINVAL;
+        return false;
+    }
+    uint8_t *newHeader = appendBytes(bytes, headerSize + (zip64Extra ? 8 : 12));
+    if (!newHeader) {
+        return false;
+    }
+    uint8_t *newExtra = newHeader + ZIP_CENTRAL_HEADER_SIZE + nameSize;
+    memcpy(newHeader, header, ZIP_CENTRAL_HEADER_SIZE + nameSize);
+    if (zip64Extra) {
+        size_t beforeOffsetSize = zip64Extra - extra + zip64OffsetPosition;
+        memcpy(newExtra, extra, beforeOffsetSize);
+        putU16(newExtra + (zip64Extra - extra) - 2, (uint16_t) (zip64ExtraSize + 8));
+        putU64(newExtra + beforeOffsetSize, offset);
+        memcpy(newExtra + beforeOffsetSize + 8, extra + beforeOffsetSize,
+                headerSize - ZIP_CENTRAL_HEADER_SIZE - nameSize - beforeOffsetSize);
+        putU16(newHeader + 30, (uint16_t) (extraSize + 8));
+    } else {
+        memcpy(newExtra, extra, extraSize);
+        putU16(newExtra + extraSize, ZIP64_EXTRA_ID);
+        putU16(newExtra + extraSize + 2, 8);
+        putU64(newExtra + extraSize + 4, offset);
+        memcpy(newExtra + extraSize + 12, extra + extraSize,
+                headerSize - ZIP_CENTRAL_HEADER_SIZE - nameSize - extraSize);
+        putU16(newHeader + 30, (uint16_t) (extraSize + 12));
+    }
+    putU32(newHeader + 42, UINT32_MAX);
+    if (zipGetU16(newHeader + 6) < ZIP64_VERSION) {
+        putU16(newHeader + 6, ZIP64_VERSION);
+    }
+    return true;
+}
+
+static bool appendEndRecords(struct Bytes *bytes, uint64_t entryCount,
+                             uint64_t centralDirectorySize, uint64_t centralDirectoryOffset,
+                             const uint8_t *comment, size_t commentSize) {
+    if (entryCount >= UINT16_MAX || centralDirectorySize >= UINT32_MAX
+            || centralDirectoryOffset >= UINT32_MAX) {
+        uint8_t *zip64Eocd = appendBytes(bytes, ZIP64_EOCD_SIZE + ZIP64_EOCD_LOCATOR_SIZE);
+        if (!zip64Eocd) {
+            return false;
+        }
+        putU32(zip64Eocd, ZIP64_EOCD_SIGNATURE);
+        putU64(zip64Eocd + 4, ZIP64_EOCD_SIZE - 12);
+        putU16(zip64Eocd + 12, ZIP64_VERSION);
+        putU16(zip64Eocd + 14, ZIP64_VERSION);
+        putU32(zip64Eocd + 16, 0);
+        putU32(zip64Eocd + 20, 0);
+        putU64(zip64Eocd + 24, entryCount);
+        putU64(zip64Eocd + 32, entryCount);
+        putU64(zip64Eocd + 40, centralDirectorySize);
+        putU64(zip64Eocd + 48, centralDirectoryOffset);
+        uint8_t *locator = zip64Eocd + ZIP64_EOCD_SIZE;
+        putU32(locator, ZIP64_EOCD_LOCATOR_SIGNATURE);
+        putU32(locator + 4, 0);
+        putU64(locator + 8, centralDirectoryOffset + centralDirectorySize);
+        putU32(locator + 16, 1);
+    }
+    uint8_t *eocd = appendBytes(bytes, ZIP_EOCD_SIZE + commentSize);
+    if (!eocd) {
+        return false;
+    }
+    uint16_t entryCount16 = entryCount < UINT16_MAX ? (uint16_t) entryCount : UINT16_MAX;
+    putU32(eocd, ZIP_EOCD_SIGNATURE);
+    putU16(eocd + 4, 0);
+    putU16(eocd + 6, 0);
+    putU16(eocd + 8, entryCount16);
+    putU16(eocd + 10, entryCount16);
+    putU32(eocd + 12, centralDirectorySize < UINT32_MAX ? (uint32_t) centralDirectorySize
+            : UINT32_MAX);
+    putU32(eocd + 16, centralDirectoryOffset < UINT32_MAX ? (uint32_t) centralDirectoryOffset
+            : UINT32_MAX);
+    putU16(eocd + 20, (uint16_t) commentSize);
+    memcpy(eocd + ZIP_EOCD_SIZE, comment, commentSize);
+    return true;
+}
+
+// Appends the central directory headers of the entries copied before streamOffset of libarchive's
+// output, and adds up the size of everything inserted before it.
+static bool appendCopiedCentralHeaders(struct ZipAppend *zipAppend, struct Bytes *bytes,
+                                       uint64_t streamOffset, size_t *insertionIndex,
+                                       size_t *copiedHeaderOffset, uint64_t *insertedSize) {
+    for (; *insertionIndex < zipAppend->insertionCount; ++*insertionIndex) {
+        const struct Insertion *insertion = &zipAppend->insertions[*insertionIndex];
+        if (insertion->streamOffset > streamOffset) {
+            break;
+        }
+        if (insertion->centralHeaderSize) {
+            uint8_t *header = appendBytes(bytes, insertion->centralHeaderSize);
+            if (!header) {
+                return false;
+            }
+            memcpy(header, zipAppend->copiedCentralDirectory.data + *copiedHeaderOffset,
+                    insertion->centralHeaderSize);
+            *copiedHeaderOffset += insertion->centralHeaderSize;
+        }
+        *insertedSize += insertion->size;
+    }
+    return true;
+}
+
+static bool mergeCentralDirectories(struct ZipAppend *zipAppend) {
+    // libarchive's central directory comes after everything inserted.
+    uint64_t streamStart = zipAppend->baseOffset + zipAppend->insertedSize;
+    struct ZipCentralDirectoryInfo newInfo;
+    if (!zipReadCentralDirectoryInfo(zipAppend->fd, streamStart,
+            streamStart + zipAppend->writtenSize, &newInfo)) {
+        return false;
+    }
+    uint8_t *newCentralDirectory = malloc(newInfo.size ? newInfo.size : 1);
+    if (!newCentralDirectory) {
+        return false;
+    }
+    if (!zipReadFully(zipAppend->fd, newCentralDirectory, newInfo.size,
+            streamStart + newInfo.offset)) {
+        free(newCentralDirectory);
+        return false;
+    }
+    struct Bytes bytes = { 0 };
+    bool isSuccessful = true;
+    if (zipAppend->oldCentralDirectorySize) {
+        uint8_t *oldCentralDirectory = appendBytes(&bytes, zipAppend->oldCentralDirectorySize);
+        if (oldCentralDirectory) {
+            memcpy(oldCentralDirectory, zipAppend->oldTail, zipAppend->oldCentralDirectorySize);
+        } else {
+            isSuccessful = false;
+        }
+    }
+    // The new and the copied entries are listed in the order they were written.
+    size_t insertionIndex = 0;
+    size_t copiedHeaderOffset = 0;
+    uint64_t insertedSize = 0;
+    uint64_t newEntryCount = 0;
+    for (size_t i = 0; isSuccessful && i < newInfo.size; ++newEntryCount) {
+        const uint8_t *header = newCentralDirectory + i;
+        if (newInfo.size - i < ZIP_CENTRAL_HEADER_SIZE
+                || zipGetU32(header) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+            errno = EINVAL;
+            isSuccessful = false;
+            break;
+        }
+        size_t headerSize = zipGetCentralHeaderSize(header);
+        uint64_t streamOffset;
+        if (newInfo.size - i < headerSize) {
+            errno = EINVAL;
+            isSuccessful = false;
+            break;
+        }
+        isSuccessful = zipGetCentralHeaderValue(header, 42, &streamOffset)
+                && appendCopiedCentralHeaders(zipAppend, &bytes, streamOffset, &insertionIndex,
+                        &copiedHeaderOffset, &insertedSize)
+                && appendMovedCentralHeader(&bytes, header, headerSize,
+                        zipAppend->baseOffset + insertedSize);
+        i += headerSize;
+    }
+    free(newCentralDirectory);
+    isSuccessful = isSuccessful && appendCopiedCentralHeaders(zipAppend, &bytes, UINT64_MAX,
+            &insertionIndex, &copiedHeaderOffset, &insertedSize);
+    // The merged central directory replaces libarchive's, right after the new entries.
+    uint64_t centralDirectoryOffset = streamStart + newInfo.offset;
+    uint64_t centralDirectorySize = bytes.size;
+    uint64_t entryCount = zipAppend->oldEntryCount + newEntryCount + zipAppend->copiedEntryCount;
+    isSuccessful = isSuccessful && appendEndRecords(&bytes, entryCount, centralDirectorySize,
+            centralDirectoryOffset,
+            zipAppend->oldTail + zipAppend->oldTailSize - zipAppend->commentSize,
+            zipAppend->commentSize)
+            && writeFully(zipAppend->fd, bytes.data, bytes.size, centralDirectoryOffset)
+            && !ftruncate(zipAppend->fd, (off_t) (centralDirectoryOffset + bytes.size));
+    int savedErrno = errno;
+    free(bytes.data);
+    errno = savedErrno;
+    return isSuccessful;
+}
+
+static bool copyData(int sourceFd, uint64_t sourceOffset, int fd, uint64_t offset, uint64_t size,
+                     uint8_t *buffer) {
+    while (size) {
+        size_t chunkSize = size < COPY_BUFFER_SIZE ? (size_t) size : COPY_BUFFER_SIZE;
+        if (!zipReadFully(sourceFd, buffer, chunkSize, sourceOffset)
+                || !writeFully(fd, buffer, chunkSize, offset)) {
+            return false;
+        }
+        sourceOffset += chunkSize;
+        offset += chunkSize;
+        size -= chunkSize;
+    }
+    return true;
+}
+
+// Removes the alignment extra fields from an extra field, and returns its new size.
+static size_t removeAlignmentExtras(uint8_t *extra, size_t extraSize) {
+    size_t position = 0;
+    while (extraSize - position >= 4) {
+        size_t fieldSize = 4 + (size_t) zipGetU16(extra + position + 2);
+        if (fieldSize > extraSize - position) {
+            break;
+        }
+        if (zipGetU16(extra + position) == ZIP_ALIGNMENT_EXTRA_ID) {
+            memmove(extra + position, extra + position + fieldSize,
+                    extraSize - position - fieldSize);
+            extraSize -= fieldSize;
+        } else {
+            position += fieldSize;
+        }
+    }
+    return extraSize;
+}
+
+static bool isValidUtf8(const uint8_t *string, size_t size) {
+    size_t position = 0;
+    while (position < size) {
+        uint8_t byte = string[position];
+        size_t continuationCount;
+        uint32_t codePoint;
+        if (byte < 0x80) {
+            ++position;
+            continue;
+        } else if (byte >= 0xC2 && byte <= 0xDF) {
+            continuationCount = 1;
+            codePoint = byte & 0x1F;
+        } else if (byte >= 0xE0 && byte <= 0xEF) {
+            continuationCount = 2;
+            codePoint = byte & 0x0F;
+        } else if (byte >= 0xF0 && byte <= 0xF4) {
+            continuationCount = 3;
+            codePoint = byte & 0x07;
+        } else {
+            return false;
+        }
+        if (continuationCount > size - position - 1) {
+            return false;
+        }
+        for (size_t i = 1; i <= continuationCount; ++i) {
+            uint8_t continuationByte = string[position + i];
+            if ((continuationByte & 0xC0) != 0x80) {
+                return false;
+            }
+            codePoint = codePoint << 6 | (continuationByte & 0x3F);
+        }
+        // Reject overlong forms, surrogates and code points beyond U+10FFFF.
+        if ((continuationCount == 2 && codePoint < 0x800)
+                || (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+                || (continuationCount == 3 && (codePoint < 0x10000 || codePoint > 0x10FFFF))) {
+            return false;
+        }
+        position += 1 + continuationCount;
+    }
+    return true;
+}
+
+// Returns the general purpose flags for a renamed entry, with the language encoding flag (bit 11)
+// set if the new name is non-ASCII UTF-8, or cleared if it's non-ASCII in another encoding.
+static uint16_t getRenamedEntryFlags(uint16_t flags, const uint8_t *newName, size_t newNameSize) {
+    bool isAscii = true;
+    for (size_t i = 0; i < newNameSize; ++i) {
+        if (newName[i] >= 0x80) {
+            isAscii = false;
+            break;
+        }
+    }
+    if (isAscii) {
+        return flags;
+    }
+    return isValidUtf8(newName, newNameSize) ? flags | (1 << 11) : flags & ~(1 << 11);
+}
+
+static bool copyEntry(struct ZipAppend *zipAppend, int sourceFd, const uint8_t *header,
+                      const char *newPathname, uint8_t *buffer) {
+    uint64_t sourceOffset;
+    uint64_t compressedSize;
+    uint8_t localHeader[ZIP_LOCAL_HEADER_SIZE];
+    if (!zipGetCentralHeaderValue(header, 42, &sourceOffset)
+            || !zipGetCentralHeaderValue(header, 20, &compressedSize)
+            || !zipReadFully(sourceFd, localHeader, sizeof(localHeader), sourceOffset)) {
+        return false;
+    }
+    if (zipGetU32(localHeader) != ZIP_LOCAL_HEADER_SIGNATURE) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t nameSize = zipGetU16(header + 28);
+    const uint8_t *newName = newPathname ? (const uint8_t *) newPathname
+            : header + ZIP_CENTRAL_HEADER_SIZE;
+    size_t newNameSize = newPathname ? strlen(newPathname) : nameSize;
+    if (newNameSize > UINT16_MAX) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    size_t localNameSize = zipGetU16(localHeader + 26);
+    size_t localExtraSize = zipGetU16(localHeader + 28);
+    size_t headerRestSize = zipGetU16(header + 30) + zipGetU16(header + 32);
+    size_t newLocalHeaderSize = ZIP_LOCAL_HEADER_SIZE + newNameSize + localExtraSize;
+    size_t newHeaderSize = ZIP_CENTRAL_HEADER_SIZE + newNameSize + headerRestSize;
+    uint32_t maxAlignment = zipAppend->alignment > zipAppend->sharedLibraryAlignment
+            ? zipAppend->alignment : zipAppend->sharedLibraryAlignment;
+    size_t maxPaddingSize = maxAlignment > 1 ? maxAlignment + ZIP_ALIGNMENT_EXTRA_MIN_SIZE : 0;
+    uint8_t *newHeaders = malloc(newLocalHeaderSize + maxPaddingSize + newHeaderSize);
+    if (!newHeaders) {
+        return false;
+    }
+    uint8_t *newLocalHeader = newHeaders;
+    memcpy(newLocalHeader, localHeader, ZIP_LOCAL_HEADER_SIZE);
+    if (newPathname) {
+        putU16(newLocalHeader + 6, getRenamedEntryFlags(zipGetU16(localHeader + 6), newName,
+                newNameSize));
+    }
+    putU16(newLocalHeader + 26, (uint16_t) newNameSize);
+    memcpy(newLocalHeader + ZIP_LOCAL_HEADER_SIZE, newName, newNameSize);
+    uint8_t *newLocalExtra = newLocalHeader + ZIP_LOCAL_HEADER_SIZE + newNameSize;
+    uint64_t dataOffset = sourceOffset + ZIP_LOCAL_HEADER_SIZE + localNameSize + localExtraSize;
+    uint64_t dataSize = compressedSize;
+    bool isSuccessful = zipReadFully(sourceFd, newLocalExtra, localExtraSize,
+            dataOffset - localExtraSize);
+    // The data descriptor has 8 byte sizes if the local header has a zip64 extra field.
+    if (isSuccessful && (zipGetU16(localHeader + 6) & (1 << 3))) {
+        size_t zip64ExtraSize;
+        bool isZip64 = zipFindZip64Extra(newLocalExtra, localExtraSize, &zip64ExtraSize);
+        uint8_t signature[4];
+        isSuccessful = zipReadFully(sourceFd, signature, sizeof(signature), dataOffset + dataSize);
+        dataSize += (zipGetU32(signature) == ZIP_DATA_DESCRIPTOR_SIGNATURE ? 4 : 0) + 4
+                + (isZip64 ? 16 : 8);
+    }
+    uint64_t offset = zipAppend->baseOffset + zipAppend->insertedSize + zipAppend->writtenSize;
+    // Any alignment of the source is replaced with one for the new offset.
+    if (isSuccessful && maxPaddingSize) {
+        size_t newLocalExtraSize = removeAlignmentExtras(newLocalExtra, localExtraSize);
+        putU16(newLocalHeader + 28, (uint16_t) newLocalExtraSize);
+        uint32_t alignment;
+        size_t paddingSize = getAlignmentPaddingSize(zipAppend, newLocalHeader, offset,
+                &alignment);
+        if (paddingSize) {
+            putAlignmentExtra(newLocalExtra + newLocalExtraSize, paddingSize, alignment);
+            putU16(newLocalHeader + 28, (uint16_t) (newLocalExtraSize + paddingSize));
+        }
+        newLocalHeaderSize = ZIP_LOCAL_HEADER_SIZE + newNameSize + newLocalExtraSize
+                + paddingSize;
+    }
+    isSuccessful = isSuccessful
+            && writeFully(zipAppend->fd, newLocalHeader, newLocalHeaderSize, offset)
+            && copyData(sourceFd, dataOffset, zipAppend->fd, offset + newLocalHeaderSize, dataSize,
+                    buffer);
+    uint8_t *newHeader = newHeaders + ZIP_LOCAL_HEADER_SIZE + newNameSize + localExtraSize
+            + maxPaddingSize;
+    memcpy(newHeader, header, ZIP_CENTRAL_HEADER_SIZE);
+    if (newPathname) {
+        putU16(newHeader + 8, getRenamedEntryFlags(zipGetU16(header + 8), newName, newNameSize));
+    }
+    putU16(newHeader + 28, (uint16_t) newNameSize);
+    memcpy(newHeader + ZIP_CENTRAL_HEADER_SIZE, newName, newNameSize);
+    memcpy(newHeader + ZIP_CENTRAL_HEADER_SIZE + newNameSize,
+            header + ZIP_CENTRAL_HEADER_SIZE + nameSize, headerRestSize);
+    size_t oldCopiedCentralDirectorySize = zipAppend->copiedCentralDirectory.size;
+    // The offset delta wraps around if the entry moves backwards.
+    isSuccessful = isSuccessful && appendMovedCentralHeader(&zipAppend->copiedCentralDirectory,
+            newHeader, newHeaderSize, offset - sourceOffset)
+            && addInsertion(zipAppend, newLocalHeaderSize + dataSize,
+                    zipAppend->copiedCentralDirectory.size - oldCopiedCentralDirectorySize);
+    if (isSuccessful) {
+        ++zipAppend->copiedEntryCount;
+    }
+    int savedErrno = errno;
+    free(newHeaders);
+    errno = savedErrno;
+    return isSuccessful;
+}
+
+bool zipAppendCopyEntries(struct ZipAppend *zipAppend, int sourceFd, const char *const *pathnames,
+                          const char *const *newPathnames, size_t count) {
+    struct stat fileStat;
+    struct stat sourceFileStat;
+    if (fstat(zipAppend->fd, &fileStat) || fstat(sourceFd, &sourceFileStat)) {
+        return false;
+    }
+    if (zipAppend->isClosed || (fileStat.st_dev == sourceFileStat.st_dev
+            && fileStat.st_ino == sourceFileStat.st_ino)) {
+        errno = EINVAL;
+        return false;
+    }
+    struct ZipCentralDirectory source;
+    if (!zipReadCentralDirectory(sourceFd, &source)) {
+        return false;
+    }
+    uint8_t *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        zipFreeCentralDirectory(&source);
+        return false;
+    }
+    // Copies are all or nothing, and the data of failed ones is overwritten later.
+    size_t oldInsertionCount = zipAppend->insertionCount;
+    uint64_t oldInsertedSize = zipAppend->insertedSize;
+    size_t oldCopiedEntryCount = zipAppend->copiedEntryCount;
+    size_t oldCopiedCentralDirectorySize = zipAppend->copiedCentralDirectory.size;
+    bool isSuccessful = true;
+    for (size_t i = 0; isSuccessful && i < count; ++i) {
+        const uint8_t *header = zipFindCentralHeader(&source, pathnames[i]);
+        if (!header) {
+            errno = ENOENT;
+            isSuccessful = false;
+            break;
+        }
+        isSuccessful = copyEntry(zipAppend, sourceFd, header,
+                newPathnames ? newPathnames[i] : NULL, buffer);
+    }
+    int savedErrno = errno;
+    free(buffer);
+    zipFreeCentralDirectory(&source);
+    if (!isSuccessful) {
+        zipAppend->insertionCount = oldInsertionCount;
+        zipAppend->insertedSize = oldInsertedSize;
+        zipAppend->copiedEntryCount = oldCopiedEntryCount;
+        zipAppend->copiedCentralDirectory.size = oldCopiedCentralDirectorySize;
+    }
+    errno = savedErrno;
+    return isSuccessful;
+}
+
+bool zipAppendClose(struct ZipAppend *zipAppend) {
+    if (!zipAppend->isClosed) {
+        zipAppend->isClosed = true;
+        bool isSuccessful = !zipAppend->isLocalHeaderPending
+                || writePendingLocalHeader(zipAppend, false);
+        if (!isSuccessful || !mergeCentralDirectories(zipAppend)) {
+            zipAppend->closeErrno = errno ? errno : EIO;
+            restoreOldTail(zipAppend);
+        }
+    }
+    if (zipAppend->closeErrno) {
+        errno = zipAppend->closeErrno;
+        return false;
+    }
+    return true;
+}
+
+void zipAppendFree(struct ZipAppend *zipAppend) {
+    if (!zipAppend) {
+        return;
+    }
+    if (!zipAppend->isClosed) {
+        restoreOldTail(zipAppend);
+    }
+    free(zipAppend->oldTail);
+    free(zipAppend->insertions);
+    free(zipAppend->copiedCentralDirectory.data);
+    free(zipAppend->pendingLocalHeader.data);
+    free(zipAppend);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Appending entries to an existing zip file in place, see zip-append.c.
+
+#ifndef LIBARCHIVE_ANDROID_ZIP_APPEND_H
+#define LIBARCHIVE_ANDROID_ZIP_APPEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct ZipAppend;
+
+// Reads the central directory of the zip file, which new entries will be written over, or starts
+// a new zip if the file is empty. The file descriptor must be readable, writable and seekable, and
+// stays owned by the caller. Returns NULL with errno set on failure, e.g. EINVAL if the file isn't
+// a single disk zip.
+struct ZipAppend *zipAppendOpen(int fd);
+
+// Aligns the data of stored entries written from now on to a multiple of alignment bytes, or of
+// sharedLibraryAlignment for .so files unless it's 0, as zipalign does. The alignments must be
+// powers of two up to 32 KiB, and 0 or 1 means no alignment.
+void zipAppendSetAlignment(struct ZipAppend *zipAppend, uint32_t alignment,
+                           uint32_t sharedLibraryAlignment);
+
+// Marks the start of an entry in libarchive's output, which must not have any data of the previous
+// entry left to be written, so that its local header can be padded for alignment.
+void zipAppendBeginEntry(struct ZipAppend *zipAppend);
+
+// Writes libarchive's zip output after the existing entries. Returns -1 with errno set on failure.
+ssize_t zipAppendWrite(struct ZipAppend *zipAppend, const void *buffer, size_t size);
+
+// Copies entries of another zip file verbatim after the data written so far, without
+// decompressing or decrypting them. Each entry is looked up by its pathname and renamed to the new
+// pathname unless newPathnames or the new pathname is NULL. A non-ASCII new pathname is flagged as
+// UTF-8 if it's valid UTF-8, and is otherwise taken to be in the legacy encoding of the source
+// entry. Either all entries are copied, or false is returned with errno set, e.g. ENOENT if an
+// entry isn't found or EINVAL if the source is the same file.
+bool zipAppendCopyEntries(struct ZipAppend *zipAppend, int sourceFd, const char *const *pathnames,
+                          const char *const *newPathnames, size_t count);
+
+// Merges the central directory written by libarchive with the existing one, or writes the old one
+// back and returns false with errno set if that failed, e.g. because libarchive's output is
+// incomplete. Closing again returns the same result.
+bool zipAppendClose(struct ZipAppend *zipAppend);
+
+// Also writes the old central directory back if not closed.
+void zipAppendFree(struct ZipAppend *zipAppend);
+
+#endif // LIBARCHIVE_ANDROID_ZIP_APPEND_H
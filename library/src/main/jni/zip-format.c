@@ -0,0 +1,259 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Zips may be larger than 2 GiB on 32-bit ABIs too.
+#define _FILE_OFFSET_BITS 64
+
+#include "zip-format.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool zipReadFully(int fd, void *buffer, size_t size, uint64_t offset) {
+    uint8_t *bytes = buffer;
+    while (size) {
+        ssize_t bytesRead = pread(fd, bytes, size, (off_t) offset);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (!bytesRead) {
+            errno = EINVAL;
+            return false;
+        }
+        bytes += bytesRead;
+        size -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
+}
+
+bool zipReadCentralDirectoryInfo(int fd, uint64_t start, uint64_t end,
+                                 struct ZipCentralDirectoryInfo *info) {
+    uint64_t tailSize = end - start;
+    if (tailSize > ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE) {
+        tailSize = ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE;
+    }
+    if (tailSize < ZIP_EOCD_SIZE) {
+        errno = EINVAL;
+        return false;
+    }
+    uint8_t *tail = malloc(tailSize);
+    if (!tail) {
+        return false;
+    }
+    if (!zipReadFully(fd, tail, tailSize, end - tailSize)) {
+        free(tail);
+        return false;
+    }
+    const uint8_t *eocd = NULL;
+    for (size_t i = tailSize - ZIP_EOCD_SIZE + 1; i > 0; --i) {
+        const uint8_t *candidate = tail + i - 1;
+        if (zipGetU32(candidate) == ZIP_EOCD_SIGNATURE
+                && i - 1 + ZIP_EOCD_SIZE + zipGetU16(candidate + 20) == tailSize) {
+            eocd = candidate;
+            break;
+        }
+    }
+    if (!eocd || zipGetU16(eocd + 4) || zipGetU16(eocd + 6)) {
+        free(tail);
+        errno = EINVAL;
+        return false;
+    }
+    uint64_t endRecordsOffset = end - start - (tailSize - (eocd - tail));
+    info->entryCount = zipGetU16(eocd + 10);
+    info->size = zipGetU32(eocd + 12);
+    info->offset = zipGetU32(eocd + 16);
+    info->commentSize = zipGetU16(eocd + 20);
+    free(tail);
+    if (endRecordsOffset >= ZIP64_EOCD_LOCATOR_SIZE + ZIP64_EOCD_SIZE) {
+        uint8_t locator[ZIP64_EOCD_LOCATOR_SIZE];
+        if (!zipReadFully(fd, locator, sizeof(locator),
+                start + endRecordsOffset - ZIP64_EOCD_LOCATOR_SIZE)) {
+            return false;
+        }
+        if (zipGetU32(locator) == ZIP64_EOCD_LOCATOR_SIGNATURE) {
+            uint64_t zip64EocdOffset = zipGetU64(locator + 8);
+            uint8_t zip64Eocd[ZIP64_EOCD_SIZE];
+            if (zipGetU32(locator + 4) || zip64EocdOffset
+                    > endRecordsOffset - ZIP64_EOCD_LOCATOR_SIZE - ZIP64_EOCD_SIZE) {
+                errno = EINVAL;
+                return false;
+            }
+            if (!zipReadFully(fd, zip64Eocd, sizeof(zip64Eocd), start + zip64EocdOffset)) {
+                return false;
+            }
+            if (zipGetU32(zip64Eocd) != ZIP64_EOCD_SIGNATURE) {
+                errno = EINVAL;
+                return false;
+            }
+            info->entryCount = zipGetU64(zip64Eocd + 32);
+            info->size = zipGetU64(zip64Eocd + 40);
+            info->offset = zipGetU64(zip64Eocd + 48);
+            endRecordsOffset = zip64EocdOffset;
+        }
+    }
+    if (info->offset > endRecordsOffset || info->size != endRecordsOffset - info->offset
+            || info->size > SIZE_MAX) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+static uint32_t hashName(const uint8_t *name, size_t nameSize) {
+    // FNV-1a.
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < nameSize; ++i) {
+        hash = (hash ^ name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool zipReadCentralDirectory(int fd, struct ZipCentralDirectory *directory) {
+    memset(directory, 0, sizeof(*directory));
+    struct stat fileStat;
+    if (fstat(fd, &fileStat)) {
+        return false;
+    }
+    struct ZipCentralDirectoryInfo info;
+    if (!zipReadCentralDirectoryInfo(fd, 0, (uint64_t) fileStat.st_size, &info)) {
+        return false;
+    }
+    directory->headersSize = (size_t) info.size;
+    // Each header is at least ZIP_CENTRAL_HEADER_SIZE bytes, and the table is at most half full.
+    directory->tableSize = 16;
+    while (directory->tableSize < directory->headersSize / ZIP_CENTRAL_HEADER_SIZE * 2) {
+        directory->tableSize *= 2;
+    }
+    directory->headers = malloc(info.size ? info.size : 1);
+    directory->table = calloc(directory->tableSize, sizeof(*directory->table));
+    if (!directory->headers || !directory->table
+            || !zipReadFully(fd, directory->headers, info.size, info.offset)) {
+        int savedErrno = errno;
+        zipFreeCentralDirectory(directory);
+        errno = savedErrno;
+        return false;
+    }
+    for (size_t i = 0; i < directory->headersSize; ) {
+        const uint8_t *header = directory->headers + i;
+        if (directory->headersSize - i < ZIP_CENTRAL_HEADER_SIZE
+                || zipGetU32(header) != ZIP_CENTRAL_HEADER_SIGNATURE
+                || directory->headersSize - i < zipGetCentralHeaderSize(header)) {
+            zipFreeCentralDirectory(directory);
+            errno = EINVAL;
+            return false;
+        }
+        size_t slot = hashName(header + ZIP_CENTRAL_HEADER_SIZE, zipGetU16(header + 28))
+                & (directory->tableSize - 1);
+        while (directory->table[slot]) {
+            slot = (slot + 1) & (directory->tableSize - 1);
+        }
+        directory->table[slot] = i + 1;
+        i += zipGetCentralHeaderSize(header);
+    }
+    return true;
+}
+
+void zipFreeCentralDirectory(struct ZipCentralDirectory *directory) {
+    free(directory->headers);
+    directory->headers = NULL;
+    free(directory->table);
+    directory->table = NULL;
+}
+
+const uint8_t *zipFindCentralHeader(const struct ZipCentralDirectory *directory,
+                                    const char *pathname) {
+    size_t pathnameSize = strlen(pathname);
+    const uint8_t *firstHeader = NULL;
+    size_t slot = hashName((const uint8_t *) pathname, pathnameSize) & (directory->tableSize - 1);
+    for (; directory->table[slot]; slot = (slot + 1) & (directory->tableSize - 1)) {
+        const uint8_t *header = directory->headers + directory->table[slot] - 1;
+        if (zipGetU16(header + 28) == pathnameSize
+                && !memcmp(header + ZIP_CENTRAL_HEADER_SIZE, pathname, pathnameSize)
+                && (!firstHeader || header < firstHeader)) {
+            firstHeader = header;
+        }
+    }
+    return firstHeader;
+}
+
+const uint8_t *zipFindZip64Extra(const uint8_t *extra, size_t extraSize, size_t *zip64ExtraSize) {
+    for (size_t i = 0; i + 4 <= extraSize; ) {
+        size_t blockSize = zipGetU16(extra + i + 2);
+        if (i + 4 + blockSize > extraSize) {
+            break;
+        }
+        if (zipGetU16(extra + i) == ZIP64_EXTRA_ID) {
+            *zip64ExtraSize = blockSize;
+            return extra + i + 4;
+        }
+        i += 4 + blockSize;
+    }
+    *zip64ExtraSize = 0;
+    return NULL;
+}
+
+size_t zipGetZip64ExtraPosition(const uint8_t *header, size_t fieldOffset) {
+    static const size_t ZIP64_FIELD_OFFSETS[] = { 24, 20, 42 };
+    size_t position = 0;
+    for (size_t i = 0; ZIP64_FIELD_OFFSETS[i] != fieldOffset; ++i) {
+        if (zipGetU32(header + ZIP64_FIELD_OFFSETS[i]) == UINT32_MAX) {
+            position += 8;
+        }
+    }
+    return position;
+}
+
+bool zipGetCentralHeaderValue(const uint8_t *header, size_t fieldOffset, uint64_t *value) {
+    uint32_t value32 = zipGetU32(header + fieldOffset);
+    if (value32 != UINT32_MAX) {
+        *value = value32;
+        return true;
+    }
+    size_t zip64ExtraSize;
+    const uint8_t *zip64Extra = zipFindZip64Extra(
+            header + ZIP_CENTRAL_HEADER_SIZE + zipGetU16(header + 28), zipGetU16(header + 30),
+            &zip64ExtraSize);
+    size_t position = zipGetZip64ExtraPosition(header, fieldOffset);
+    if (!zip64Extra || position + 8 > zip64ExtraSize) {
+        errno = EINVAL;
+        return false;
+    }
+    *value = zipGetU64(zip64Extra + position);
+    return true;
+}
+
+bool zipGetDataOffset(int fd, const uint8_t *header, uint64_t *dataOffset) {
+    uint64_t localHeaderOffset;
+    uint8_t localHeader[ZIP_LOCAL_HEADER_SIZE];
+    if (!zipGetCentralHeaderValue(header, 42, &localHeaderOffset)
+            || !zipReadFully(fd, localHeader, sizeof(localHeader), localHeaderOffset)) {
+        return false;
+    }
+    if (zipGetU32(localHeader) != ZIP_LOCAL_HEADER_SIGNATURE) {
+        errno = EINVAL;
+        return false;
+    }
+    *dataOffset = localHeaderOffset + ZIP_LOCAL_HEADER_SIZE + zipGetU16(localHeader + 26)
+            + zipGetU16(localHeader + 28);
+    return true;
+}
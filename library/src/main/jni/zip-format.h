@@ -0,0 +1,108 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Parsing of zip files for the raw access that libarchive doesn't have, see zip-format.c.
+
+#ifndef LIBARCHIVE_ANDROID_ZIP_FORMAT_H
+#define LIBARCHIVE_ANDROID_ZIP_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_DATA_DESCRIPTOR_SIGNATURE 0x08074b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_EOCD_SIGNATURE 0x06054b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP64_EOCD_SIGNATURE 0x06064b50
+#define ZIP64_EOCD_SIZE 56
+#define ZIP64_EOCD_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_EOCD_LOCATOR_SIZE 20
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP64_VERSION 45
+// The extra field that zipalign pads local headers with, holding the alignment and zeros.
+#define ZIP_ALIGNMENT_EXTRA_ID 0xD935
+#define ZIP_ALIGNMENT_EXTRA_MIN_SIZE 6
+#define ZIP_MAX_COMMENT_SIZE 0xFFFF
+
+struct ZipCentralDirectoryInfo {
+    uint64_t entryCount;
+    uint64_t size;
+    uint64_t offset;
+    size_t commentSize;
+};
+
+// The central directory headers of a zip, with a hash table of them by name.
+struct ZipCentralDirectory {
+    uint8_t *headers;
+    size_t headersSize;
+    // Offsets of the headers plus one, or 0 for an empty slot.
+    size_t *table;
+    size_t tableSize;
+};
+
+static inline uint16_t zipGetU16(const uint8_t *bytes) {
+    return (uint16_t) (bytes[0] | bytes[1] << 8);
+}
+
+static inline uint32_t zipGetU32(const uint8_t *bytes) {
+    return zipGetU16(bytes) | (uint32_t) zipGetU16(bytes + 2) << 16;
+}
+
+static inline uint64_t zipGetU64(const uint8_t *bytes) {
+    return zipGetU32(bytes) | (uint64_t) zipGetU32(bytes + 4) << 32;
+}
+
+// Reads exactly size bytes, or returns false with errno set, EINVAL if the file ends early.
+bool zipReadFully(int fd, void *buffer, size_t size, uint64_t offset);
+
+// Locates the central directory of the zip in [start, end) of the file, with offsets relative to
+// start, and requires it to be followed directly by the end records.
+bool zipReadCentralDirectoryInfo(int fd, uint64_t start, uint64_t end,
+                                 struct ZipCentralDirectoryInfo *info);
+
+// Reads and checks all central directory headers of the zip file, or returns false with errno set.
+bool zipReadCentralDirectory(int fd, struct ZipCentralDirectory *directory);
+
+void zipFreeCentralDirectory(struct ZipCentralDirectory *directory);
+
+// Returns the first central directory header with the name, or NULL.
+const uint8_t *zipFindCentralHeader(const struct ZipCentralDirectory *directory,
+                                    const char *pathname);
+
+static inline size_t zipGetCentralHeaderSize(const uint8_t *header) {
+    return ZIP_CENTRAL_HEADER_SIZE + zipGetU16(header + 28) + zipGetU16(header + 30)
+            + zipGetU16(header + 32);
+}
+
+// Returns the data of the zip64 extra field, or NULL.
+const uint8_t *zipFindZip64Extra(const uint8_t *extra, size_t extraSize, size_t *zip64ExtraSize);
+
+// The zip64 extra field of a central directory header has the values that don't fit, in the order
+// of the uncompressed size (at 24), the compressed size (at 20) and the local header offset (at
+// 42). Returns the position of the value for the field in the zip64 extra field.
+size_t zipGetZip64ExtraPosition(const uint8_t *header, size_t fieldOffset);
+
+// Returns one of the above values of a central directory header, or false with errno set.
+bool zipGetCentralHeaderValue(const uint8_t *header, size_t fieldOffset, uint64_t *value);
+
+// Reads the local header of the entry to return where its data starts, or false with errno set.
+bool zipGetDataOffset(int fd, const uint8_t *header, uint64_t *dataOffset);
+
+#endif // LIBARCHIVE_ANDROID_ZIP_FORMAT_H
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2026 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A process-wide pool of zstd streams, hooked in with the linker's --wrap.
+//
+// libarchive creates a zstd stream for every archive or entry it decompresses or compresses, and
+// the window and workspace of a stream are allocated on first use, so opening many small archives
+// pays that setup every time. Freed streams are reset and kept instead, up to POOL_MAX_SIZE bytes
+// in total, and their buffers are reused when the next stream needs no more than they have.
+// liblzma, bzip2 and zlib keep a pointer back to the caller's stream in their state, so theirs
+// can't be moved to another handle from here.
+//
+// Streams are created with an allocator that records their allocations, so that these can be
+// moved to the archive that takes the stream from the pool for its memory budget and stats, and
+// are owned by no archive while pooled.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#include "archive-memory.h"
+
+#define POOL_CAPACITY 8
+#define POOL_MAX_SIZE (16 * 1024 * 1024)
+
+size_t __real_ZSTD_freeDStream(ZSTD_DStream *stream);
+size_t __real_ZSTD_freeCStream(ZSTD_CStream *stream);
+
+struct StreamAllocations {
+    void *stream;
+    void **pointers;
+    size_t count;
+    size_t capacity;
+    struct StreamAllocations *next;
+};
+
+struct StreamPool {
+    pthread_mutex_t mutex;
+    struct StreamAllocations *streams[POOL_CAPACITY];
+    size_t streamSizes[POOL_CAPACITY];
+    size_t count;
+    size_t size;
+};
+
+static struct StreamPool gDStreamPool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static struct StreamPool gCStreamPool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// All streams created here, pooled or not, by their allocations.
+static pthread_mutex_t gStreamAllocationsMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct StreamAllocations *gStreamAllocations;
+
+static void *allocateStreamMemory(void *opaque, size_t size) {
+    struct StreamAllocations *allocations = opaque;
+    if (allocations->count == allocations->capacity) {
+        size_t capacity = allocations->capacity ? allocations->capacity * 2 : 8;
+        void **pointers = realloc(allocations->pointers, capacity * sizeof(*pointers));
+        if (!pointers) {
+            return NULL;
+        }
+        allocations->pointers = pointers;
+        allocations->capacity = capacity;
+    }
+    void *pointer = malloc(size);
+    if (pointer) {
+        allocations->pointers[allocations->count++] = pointer;
+    }
+    return pointer;
+}
+
+static void freeStreamMemory(void *opaque, void *pointer) {
+    struct StreamAllocations *allocations = opaque;
+    for (size_t i = 0; i < allocations->count; ++i) {
+        if (allocations->pointers[i] == pointer) {
+            allocations->pointers[i] = allocations->pointers[--allocations->count];
+            break;
+        }
+    }
+    free(pointer);
+}
+
+static struct StreamAllocations *newStreamAllocations(ZSTD_customMem *outCustomMem) {
+    struct StreamAllocations *allocations = calloc(1, sizeof(*allocations));
+    if (allocations) {
+        outCustomMem->customAlloc = allocateStreamMemory;
+        outCustomMem->customFree = freeStreamMemory;
+        outCustomMem->opaque = allocations;
+    }
+    return allocations;
+}
+
+// Takes ownership of the allocations, and returns the stream.
+static void *addStreamAllocations(struct StreamAllocations *allocations, void *stream) {
+    if (!stream) {
+        free(allocations->pointers);
+        free(allocations);
+        return NULL;
+    }
+    allocations->stream = stream;
+    pthread_mutex_lock(&gStreamAllocationsMutex);
+    allocations->next = gStreamAllocations;
+    gStreamAllocations = allocations;
+    pthread_mutex_unlock(&gStreamAllocationsMutex);
+    return stream;
+}
+
+static struct StreamAllocations *findStreamAllocations(void *stream) {
+    pthread_mutex_lock(&gStreamAllocationsMutex);
+    struct StreamAllocations *allocations = gStreamAllocations;
+    while (allocations && allocations->stream != stream) {
+        allocations = allocations->next;
+    }
+    pthread_mutex_unlock(&gStreamAllocationsMutex);
+    return allocations;
+}
+
+// Called after the stream has been freed.
+static void freeStreamAllocations(struct StreamAllocations *allocations) {
+    if (!allocations) {
+        return;
+    }
+    pthread_mutex_lock(&gStreamAllocationsMutex);
+    struct StreamAllocations **link = &gStreamAllocations;
+    while (*link != allocations) {
+        link = &(*link)->next;
+    }
+    *link = allocations->next;
+    pthread_mutex_unlock(&gStreamAllocationsMutex);
+    free(allocations->pointers);
+    free(allocations);
+}
+
+static struct StreamAllocations *takePooledStream(struct StreamPool *pool) {
+    struct StreamAllocations *allocations = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->count) {
+        --pool->count;
+        allocations = pool->streams[pool->count];
+        pool->size -= pool->streamSizes[pool->count];
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return allocations;
+}
+
+static bool putPooledStream(struct StreamPool *pool, struct StreamAllocations *allocations,
+                            size_t streamSize) {
+    pthread_mutex_lock(&pool->mutex);
+    bool isPooled = pool->count < POOL_CAPACITY && streamSize <= POOL_MAX_SIZE - pool->size;
+    if (isPooled) {
+        pool->streams[pool->count] = allocations;
+        pool->streamSizes[pool->count] = streamSize;
+        ++pool->count;
+        pool->size += streamSize;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return isPooled;
+}
+
+// Makes the allocations owned by no archive, as they are while pooled.
+static void detachStreamAllocations(struct StreamAllocations *allocations) {
+    ARCHIVE_MEMORY_SCOPE(NULL);
+    archiveMemoryMoveToCurrent(allocations->pointers, allocations->count);
+}
+
+ZSTD_DStream *__wrap_ZSTD_createDStream(void) {
+    struct StreamAllocations *allocations = takePooledStream(&gDStreamPool);
+    if (allocations) {
+        if (archiveMemoryMoveToCurrent(allocations->pointers, allocations->count)) {
+            return allocations->stream;
+        }
+        // Over the budget of the archive, which a new stream is checked against as it grows.
+        __real_ZSTD_freeDStream(allocations->stream);
+        freeStreamAllocations(allocations);
+    }
+    ZSTD_customMem customMem;
+    allocations = newStreamAllocations(&customMem);
+    if (!allocations) {
+        return NULL;
+    }
+    return addStreamAllocations(allocations, ZSTD_createDStream_advanced(customMem));
+}
+
+size_t __wrap_ZSTD_freeDStream(ZSTD_DStream *stream) {
+    if (!stream) {
+        return 0;
+    }
+    struct StreamAllocations *allocations = findStreamAllocations(stream);
+    if (allocations && !ZSTD_isError(ZSTD_DCtx_reset(stream, ZSTD_reset_session_and_parameters))) {
+        detachStreamAllocations(allocations);
+        if (putPooledStream(&gDStreamPool, allocations, ZSTD_sizeof_DStream(stream))) {
+            return 0;
+        }
+    }
+    size_t result = __real_ZSTD_freeDStream(stream);
+    freeStreamAllocations(allocations);
+    return result;
+}
+
+ZSTD_CStream *__wrap_ZSTD_createCStream(void) {
+    struct StreamAllocations *allocations = takePooledStream(&gCStreamPool);
+    if (allocations) {
+        if (archiveMemoryMoveToCurrent(allocations->pointers, allocations->count)) {
+            return allocations->stream;
+        }
+        __real_ZSTD_freeCStream(allocations->stream);
+        freeStreamAllocations(allocations);
+    }
+    ZSTD_customMem customMem;
+    allocations = newStreamAllocations(&customMem);
+    if (!allocations) {
+        return NULL;
+    }
+    return addStreamAllocations(allocations, ZSTD_createCStream_advanced(customMem));
+}
+
+size_t __wrap_ZSTD_freeCStream(ZSTD_CStream *stream) {
+    if (!stream) {
+        return 0;
+    }
+    struct StreamAllocations *allocations = findStreamAllocations(stream);
+    if (allocations && !ZSTD_isError(ZSTD_CCtx_reset(stream, ZSTD_reset_session_and_parameters))) {
+        detachStreamAllocations(allocations);
+        if (putPooledStream(&gCStreamPool, allocations, ZSTD_sizeof_CStream(stream))) {
+            return 0;
+        }
+    }
+    size_t result = __real_ZSTD_freeCStream(stream);
+    freeStreamAllocations(allocations);
+    return result;
+}